@@ -0,0 +1,448 @@
+#include "../src/constUtilFuncs.h"
+
+#include "../src/box.h"
+#include "../src/bvh.h"
+#include "../src/bvh_optimizer.h"
+#include "../src/compressed_bvh.h"
+#include "../src/fast_math.h"
+#include "../src/hittable_list.h"
+#include "../src/material.h"
+#include "../src/perlin.h"
+#include "../src/quad.h"
+#include "../src/sphere.h"
+#include "../src/texture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Microbenchmarks for the intersection and shading kernels.
+//
+// Every kernel runs over a fixed batch of inputs from its own generator, seeded from the kernel's
+// name, so two runs on the same machine measure exactly the same work whichever kernels the
+// filter selects. Each result is printed as one JSON object per line on stdout:
+//
+//     {"kernel":"sphere::hit","ns_per_op":12.3,"ops_per_s":8.1e+07,"rays_per_s":8.1e+07,...}
+//
+// `rays_per_s` is only present for kernels that consume a ray. The fast_math kernels also carry
+// their largest error against libm and the bound it must stay under; any kernel over its bound,
+// or a missing earthmap.jpg for the image texture kernel, makes the bench exit with status 1.
+
+namespace {
+
+const uint32_t bench_seed = 1234;
+const int batch_size = 4096;     // Inputs per batch (fits comfortably in L2)
+const int repetitions = 15;      // Timed batches per kernel; the fastest one is reported
+const double min_batch_ms = 2.0; // Batches are repeated internally until they take this long
+
+volatile double sink; // Keeps the optimizer from discarding kernel results
+std::string filter;   // Only kernels whose name contains this are run
+
+bool selected(const std::string& kernel) {
+    return filter.empty() || kernel.find(filter) != std::string::npos;
+}
+
+class bench_rng {
+public:
+    bench_rng(uint32_t seed) : generator(seed), distribution(0.0, 1.0) {}
+
+    // Seeded from a hash (FNV-1a) of a kernel name, or of a group of kernels that share inputs.
+    bench_rng(const std::string& name) : bench_rng(hash(name)) {}
+
+    double uniform() { return distribution(generator); }
+    double uniform(double min, double max) { return min + (max-min)*uniform(); }
+    vec3 in_box(double min, double max) {
+        return vec3(uniform(min,max), uniform(min,max), uniform(min,max));
+    }
+
+private:
+    std::mt19937 generator;
+    std::uniform_real_distribution<double> distribution;
+
+    static uint32_t hash(const std::string& name) {
+        uint32_t h = 2166136261u ^ bench_seed;
+        for (unsigned char c : name) h = (h ^ c) * 16777619u;
+        return h;
+    }
+};
+
+struct bench_result {
+    double ns_per_op;
+    long   ops;
+};
+
+template <typename Kernel>
+bench_result measure(Kernel&& kernel) {
+    // Runs `kernel` (which processes one batch of `batch_size` operations and returns a value
+    // to sink) until a batch takes at least `min_batch_ms`, then reports the fastest of
+    // `repetitions` timed runs.
+    using clock = std::chrono::steady_clock;
+
+    int inner = 1;
+    while (true) {
+        auto start = clock::now();
+        for (int k = 0; k < inner; k++) sink = sink + kernel();
+        std::chrono::duration<double, std::milli> elapsed = clock::now() - start;
+        if (elapsed.count() >= min_batch_ms || inner >= (1 << 20)) break;
+        inner *= 2;
+    }
+
+    double best_ns = infinity;
+    for (int rep = 0; rep < repetitions; rep++) {
+        auto start = clock::now();
+        for (int k = 0; k < inner; k++) sink = sink + kernel();
+        std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+        best_ns = std::min(best_ns, elapsed.count());
+    }
+
+    long ops = static_cast<long>(inner) * batch_size;
+    return { best_ns / ops, ops };
+}
+
+void report(const std::string& kernel, const bench_result& result, bool ray_kernel,
+            double bytes_per_primitive = -1, const std::string& extra_fields = "") {
+    auto ops_per_s = 1e9 / result.ns_per_op;
+    std::cout << "{\"kernel\":\"" << kernel << "\""
+              << ",\"ns_per_op\":" << result.ns_per_op
+              << ",\"ops_per_s\":" << ops_per_s;
+    if (ray_kernel)
+        std::cout << ",\"rays_per_s\":" << ops_per_s;
+    if (bytes_per_primitive >= 0)
+        std::cout << ",\"bytes_per_primitive\":" << bytes_per_primitive;
+    std::cout << extra_fields
+              << ",\"ops_per_batch\":" << result.ops
+              << ",\"seed\":" << bench_seed << "}\n";
+}
+
+std::vector<ray> rays_towards(bench_rng& rng, const aabb& target, double spread) {
+    // Rays from a shell around `target` aimed at random points inside it, so most of them
+    // (but not all) hit what is being measured.
+    std::vector<ray> rays;
+    rays.reserve(batch_size);
+    auto lo = point3(target.x.min, target.y.min, target.z.min);
+    auto hi = point3(target.x.max, target.y.max, target.z.max);
+    auto center = 0.5 * (lo + hi);
+    auto radius = 0.5 * (hi - lo).length() + spread;
+
+    for (int i = 0; i < batch_size; i++) {
+        auto dir = unit_vector(rng.in_box(-1,1) + vec3(1e-6,0,0));
+        auto origin = center + radius * dir;
+        auto aim = point3(rng.uniform(lo.x(), hi.x()),
+                          rng.uniform(lo.y(), hi.y()),
+                          rng.uniform(lo.z(), hi.z()));
+        rays.emplace_back(origin, aim - origin, rng.uniform());
+    }
+    return rays;
+}
+
+template <typename Primitive>
+void bench_primitive_hit(const std::string& name, const Primitive& object) {
+    if (!selected(name)) return;
+    bench_rng rng(name);
+    auto rays = rays_towards(rng, object.bounding_box(), 1.0);
+    report(name, measure([&] {
+        hit_record rec;
+        double acc = 0;
+        for (const auto& r : rays)
+            if (object.hit(r, interval(0.001, infinity), rec)) acc += rec.t;
+        return acc;
+    }), true);
+}
+
+hittable_list six_quad_box(const point3& a, const point3& b, shared_ptr<material> mat) {
+    // The same box as box(a, b, mat), built the old way from one quad per face.
+    hittable_list sides;
+    auto dx = vec3(b.x() - a.x(), 0, 0), dy = vec3(0, b.y() - a.y(), 0), dz = vec3(0, 0, b.z() - a.z());
+    sides.add(make_shared<quad>(a, dx, dy, mat));
+    sides.add(make_shared<quad>(a + dz, dx, dy, mat));
+    sides.add(make_shared<quad>(a, dy, dz, mat));
+    sides.add(make_shared<quad>(a + dx, dy, dz, mat));
+    sides.add(make_shared<quad>(a, dx, dz, mat));
+    sides.add(make_shared<quad>(a + dy, dx, dz, mat));
+    return sides;
+}
+
+void bench_aabb_hit() {
+    if (!selected("aabb::hit")) return;
+    bench_rng rng("aabb::hit");
+    aabb box(point3(-1,-1,-1), point3(1,1,1));
+    auto rays = rays_towards(rng, aabb(point3(-2,-2,-2), point3(2,2,2)), 1.0);
+    report("aabb::hit", measure([&] {
+        double acc = 0;
+        for (const auto& r : rays)
+            acc += box.hit(r, interval(0.001, infinity));
+        return acc;
+    }), true);
+}
+
+void bench_bvh() {
+    // A random_spheres-sized scene plus a denser one to show how traversal scales. The
+    // optimized and compressed trees are traced with the same rays over the same spheres, so
+    // the four kernels of each size share one generator.
+    for (int count : {500, 20000}) {
+        auto name = "bvh_node::hit/" + std::to_string(count);
+        auto compressed_name = "compressed_bvh::hit/" + std::to_string(count);
+        bool any = false;
+        for (auto kernel : { "bvh_node::hit/", "bvh_node::occluded/", "optimized_bvh::hit/", "compressed_bvh::hit/" })
+            any = any || selected(kernel + std::to_string(count));
+        if (!any) continue;
+
+        bench_rng rng("bvh/" + std::to_string(count));
+        hittable_list list;
+        auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+        auto extent = std::cbrt(static_cast<double>(count)) * 2.0;
+        for (int i = 0; i < count; i++)
+            list.add(make_shared<sphere>(rng.in_box(-extent, extent), rng.uniform(0.1, 0.5), mat));
+
+        bvh_node bvh(list);
+        auto rays = rays_towards(rng, bvh.bounding_box(), 2.0);
+        if (selected(name))
+            report(name, measure([&] {
+                hit_record rec;
+                double acc = 0;
+                for (const auto& r : rays)
+                    if (bvh.hit(r, interval(0.001, infinity), rec)) acc += rec.t;
+                return acc;
+            }), true);
+
+        auto occluded_name = "bvh_node::occluded/" + std::to_string(count);
+        if (selected(occluded_name))
+            report(occluded_name, measure([&] {
+                double acc = 0;
+                for (const auto& r : rays)
+                    acc += bvh.occluded(r, interval(0.001, infinity));
+                return acc;
+            }), true);
+
+        auto optimized_name = "optimized_bvh::hit/" + std::to_string(count);
+        if (selected(optimized_name)) {
+            hittable_list optimized(make_shared<bvh_node>(list));
+            optimize_bvh(optimized);
+            report(optimized_name, measure([&] {
+                hit_record rec;
+                double acc = 0;
+                for (const auto& r : rays)
+                    if (optimized.hit(r, interval(0.001, infinity), rec)) acc += rec.t;
+                return acc;
+            }), true);
+        }
+
+        if (selected(compressed_name)) {
+            compressed_bvh tree(list);
+            report(compressed_name, measure([&] {
+                hit_record rec;
+                double acc = 0;
+                for (const auto& r : rays)
+                    if (tree.hit(r, interval(0.001, infinity), rec)) acc += rec.t;
+                return acc;
+            }), true, double(tree.node_bytes()) / count);
+        }
+    }
+}
+
+void bench_motion_bvh() {
+    // random_spheres' layout with most spheres moving up by as much as two of their diameters
+    // over the shutter. Each ray tests node bounds interpolated to its time.
+    if (!selected("bvh_node::hit/moving")) return;
+    bench_rng rng("bvh_node::hit/moving");
+    hittable_list list;
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    for (int a = -11; a < 11; a++)
+        for (int b = -11; b < 11; b++) {
+            point3 center(a + 0.9 * rng.uniform(), 0.2, b + 0.9 * rng.uniform());
+            if (rng.uniform() < 0.8)
+                list.add(make_shared<sphere>(center, center + vec3(0, rng.uniform(0, 0.8), 0), 0.2, mat));
+            else
+                list.add(make_shared<sphere>(center, 0.2, mat));
+        }
+
+    bvh_node bvh(list);
+    auto rays = rays_towards(rng, bvh.bounding_box(), 2.0);
+    report("bvh_node::hit/moving", measure([&] {
+        hit_record rec;
+        double acc = 0;
+        for (const auto& r : rays)
+            if (bvh.hit(r, interval(0.001, infinity), rec)) acc += rec.t;
+        return acc;
+    }), true);
+}
+
+void bench_perlin() {
+    if (!selected("perlin::turb")) return;
+    bench_rng rng("perlin::turb");
+    perlin noise;
+    std::vector<point3> points;
+    for (int i = 0; i < batch_size; i++)
+        points.push_back(rng.in_box(-50, 50));
+
+    report("perlin::turb", measure([&] {
+        double acc = 0;
+        for (const auto& p : points) acc += noise.turb(p);
+        return acc;
+    }), false);
+}
+
+bool bench_image_texture() {
+    // Fails rather than timing the solid-cyan fallback when the image can't be found.
+    if (!selected("image_texture::value")) return true;
+    image_texture tex("earthmap.jpg");
+    if (!tex.loaded()) {
+        std::cerr << "ERROR: image_texture::value needs earthmap.jpg; run from the repository or "
+                     "set RTW_IMAGES to its images directory.\n";
+        return false;
+    }
+    bench_rng rng("image_texture::value");
+    std::vector<std::pair<double,double>> uvs;
+    for (int i = 0; i < batch_size; i++)
+        uvs.emplace_back(rng.uniform(), rng.uniform());
+
+    point3 p;
+    report("image_texture::value", measure([&] {
+        double acc = 0;
+        for (const auto& uv : uvs) acc += tex.value(uv.first, uv.second, p).x();
+        return acc;
+    }), false);
+    return true;
+}
+
+void bench_materials() {
+    // Hit records come from real sphere intersections so normals, UVs and face orientation
+    // follow the same distribution as during a render. Every material scatters the same records.
+    bench_rng rng("materials");
+    sphere target(point3(0,0,0), 1.0, nullptr);
+    auto rays = rays_towards(rng, target.bounding_box(), 1.0);
+    std::vector<ray> in_rays;
+    std::vector<hit_record> records;
+    for (const auto& r : rays) {
+        hit_record rec;
+        if (target.hit(r, interval(0.001, infinity), rec)) {
+            in_rays.push_back(r);
+            records.push_back(rec);
+        }
+    }
+    for (size_t i = 0, hits = records.size(); records.size() < static_cast<size_t>(batch_size); i++) {
+        in_rays.push_back(in_rays[i % hits]);
+        records.push_back(records[i % hits]);
+    }
+
+    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    std::vector<std::pair<std::string, shared_ptr<material>>> materials = {
+        {"lambertian::scatter",    make_shared<lambertian>(color(0.4, 0.2, 0.1))},
+        {"lambertian[checker]::scatter", make_shared<lambertian>(checker)},
+        {"lambertian[noise]::scatter",   make_shared<lambertian>(make_shared<noise_texture>(4))},
+        {"metal::scatter",         make_shared<metal>(color(0.7, 0.6, 0.5), 0.1)},
+        {"dielectric::scatter",    make_shared<dielectric>(1.5)},
+        {"diffuse_light::scatter", make_shared<diffuse_light>(color(4, 4, 4))},
+    };
+
+    for (const auto& entry : materials) {
+        if (!selected(entry.first)) continue;
+        const auto& mat = *entry.second;
+        report(entry.first, measure([&] {
+            double acc = 0;
+            color attenuation;
+            ray scattered;
+            for (int i = 0; i < batch_size; i++)
+                if (mat.scatter(in_rays[i], records[i], attenuation, scattered))
+                    acc += attenuation.x() + scattered.direction().y();
+            return acc;
+        }), true);
+    }
+}
+
+template <typename Reference, typename Kernel>
+bool bench_math(const std::string& kernel, double lo, double hi, Reference libm, Kernel approx,
+                double bound) {
+    // Times `approx` over arguments in [lo, hi] (both, for two-argument functions) and, unless
+    // bound is negative (libm itself), checks its largest error against libm on a denser sweep.
+    // Returns false if the bound is exceeded.
+    if (!selected(kernel)) return true;
+    bench_rng rng(kernel);
+    std::vector<double> xs(batch_size), ys(batch_size);
+    for (int i = 0; i < batch_size; i++) {
+        xs[i] = rng.uniform(lo, hi);
+        ys[i] = rng.uniform(lo, hi);
+    }
+    auto result = measure([&] {
+        double acc = 0;
+        for (int i = 0; i < batch_size; i++) acc += approx(xs[i], ys[i]);
+        return acc;
+    });
+    if (bound < 0) {
+        report(kernel, result, false);
+        return true;
+    }
+
+    double error = 0;
+    bench_rng sweep(bench_seed);
+    for (int i = 0; i < 1000000; i++) {
+        double x = sweep.uniform(lo, hi), y = sweep.uniform(lo, hi);
+        error = std::max(error, std::fabs(approx(x, y) - libm(x, y)));
+    }
+    std::ostringstream fields;
+    fields << ",\"max_abs_error\":" << error << ",\"error_bound\":" << bound
+           << ",\"within_bound\":" << (error <= bound ? "true" : "false");
+    report(kernel, result, false, -1, fields.str());
+    return error <= bound;
+}
+
+bool bench_fast_math() {
+    // libm and both approximation modes of every fast_math.h function, over the argument ranges
+    // shading uses, each checked against the bound fast_math.h documents for it.
+    auto sin_libm = [](double x, double) { return std::sin(x); };
+    auto acos_libm = [](double x, double) { return std::acos(x); };
+    auto atan2_libm = [](double y, double x) { return std::atan2(y, x); };
+    auto pow5_libm = [](double x, double) { return std::pow(x, 5); };
+
+    bool ok = true;
+    ok &= bench_math("libm::sin", -300, 300, sin_libm, sin_libm, -1);
+    ok &= bench_math("fast_math::sin/accurate", -300, 300, sin_libm,
+                     [](double x, double) { return fast_sin_accurate(x); }, fast_sin_accurate_error);
+    ok &= bench_math("fast_math::sin/fast", -300, 300, sin_libm,
+                     [](double x, double) { return fast_sin_fast(x); }, fast_sin_fast_error);
+    ok &= bench_math("libm::acos", -1, 1, acos_libm, acos_libm, -1);
+    ok &= bench_math("fast_math::acos/accurate", -1, 1, acos_libm,
+                     [](double x, double) { return fast_acos_accurate(x); }, fast_acos_accurate_error);
+    ok &= bench_math("fast_math::acos/fast", -1, 1, acos_libm,
+                     [](double x, double) { return fast_acos_fast(x); }, fast_acos_fast_error);
+    ok &= bench_math("libm::atan2", -1, 1, atan2_libm, atan2_libm, -1);
+    ok &= bench_math("fast_math::atan2/accurate", -1, 1, atan2_libm,
+                     [](double y, double x) { return fast_atan2_accurate(y, x); }, fast_atan2_accurate_error);
+    ok &= bench_math("fast_math::atan2/fast", -1, 1, atan2_libm,
+                     [](double y, double x) { return fast_atan2_fast(y, x); }, fast_atan2_fast_error);
+    ok &= bench_math("libm::pow5", 0, 1, pow5_libm, pow5_libm, -1);
+    ok &= bench_math("fast_math::pow5", 0, 1, pow5_libm,
+                     [](double x, double) { return fast_pow5_exact(x); }, fast_pow5_exact_error);
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Usage: ray_tracing_bench [kernel-name-substring]
+    // With an argument, only kernels whose name contains it are run.
+    if (argc > 1) filter = argv[1];
+
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    bench_primitive_hit("sphere::hit", sphere(point3(0,0,0), 1.0, mat));
+    bench_primitive_hit("sphere::hit/moving", sphere(point3(0,0,0), point3(0,0.5,0), 1.0, mat));
+    bench_primitive_hit("quad::hit", quad(point3(-1,-1,0), vec3(2,0,0), vec3(0,2,0), mat));
+    bench_primitive_hit("box::hit", box(point3(-1,-1,-1), point3(1,1,1), mat));
+    bench_primitive_hit("box::hit/oriented", box(point3(0,0,0), vec3(1,1,1), vec3(1,1,0), vec3(0,1,1), mat));
+    bench_primitive_hit("box::hit/six_quads", six_quad_box(point3(-1,-1,-1), point3(1,1,1), mat));
+    bench_aabb_hit();
+    bench_bvh();
+    bench_motion_bvh();
+    bench_perlin();
+    bool texture_ok = bench_image_texture();
+    bench_materials();
+    bool math_ok = bench_fast_math();
+
+    return texture_ok && math_ok ? 0 : 1;
+}
@@ -0,0 +1,478 @@
+#include "../src/constUtilFuncs.h"
+
+#include "../src/camera.h"
+#include "../src/compressed_bvh.h"
+#include "../src/hittable_list.h"
+#include "../src/scenes.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// End-to-end throughput and image regression harness.
+//
+// Renders every built-in scene at fixed seeds and settings, measures build/render time, Mrays/s
+// and peak RSS, and compares the image against a stored reference by RMSE. Results are written
+// as JSON and checked against regress/baseline.json:
+//
+//     ray_tracing_regress                      check all scenes against the baseline
+//     ray_tracing_regress cube_small_ligth     check only the named scenes
+//     ray_tracing_regress --update             re-record reference images and baseline
+//     ray_tracing_regress --out results.json   where to write the results (default: stdout)
+//
+// Each scene renders in a child process. The exit status is nonzero if any scene regressed.
+// Textures are loaded from the repository's images/ (next to RT_REGRESS_DIR) whatever the
+// working directory.
+// random_spheres also checks the compressed BVH (compressed_bvh.h) built over its world, and
+// that a saved tree only loads back against the scene it was built for.
+
+#ifndef RT_REGRESS_DIR
+    #define RT_REGRESS_DIR "../regress"
+#endif
+
+namespace {
+
+// Fixed render settings; changing any of these invalidates the stored references.
+const int image_width       = 128;
+const int samples_per_pixel = 32;
+const int max_depth         = 20;
+const uint64_t render_seed  = 2024;
+
+struct tolerances {
+    double rmse             = 0.01; // Max RMSE against the reference, on [0,1] channel values
+    double throughput_drop  = 0.25; // Max fractional Mrays/s drop below the baseline
+    double peak_rss_growth  = 0.25; // Max fractional peak RSS growth above the baseline
+};
+
+struct scene_result {
+    std::string name;
+    double build_ms;
+    double render_ms;
+    uint64_t rays;
+    double mrays_per_s;
+    long peak_rss_kb;
+    double rmse = -1; // Negative when there is no reference image
+    std::vector<std::string> failures;
+};
+
+// A deliberately small JSON reader: objects, numbers, strings and literals, flattened into
+// dotted keys ("scenes.earth.mrays_per_s"). That is all the baseline file needs.
+class flat_json {
+public:
+    std::map<std::string, double> numbers;
+
+    bool parse(const std::string& text) {
+        src = text;
+        pos = 0;
+        return value("") && (skip_ws(), pos == src.size());
+    }
+
+    bool has(const std::string& key) const { return numbers.count(key) > 0; }
+    double get(const std::string& key, double fallback) const {
+        auto it = numbers.find(key);
+        return it == numbers.end() ? fallback : it->second;
+    }
+
+private:
+    std::string src;
+    size_t pos;
+
+    void skip_ws() { while (pos < src.size() && std::isspace(static_cast<unsigned char>(src[pos]))) pos++; }
+
+    bool string(std::string& s) {
+        if (src[pos] != '"') return false;
+        for (pos++; pos < src.size() && src[pos] != '"'; pos++) {
+            if (src[pos] == '\\') pos++;
+            s += src[pos];
+        }
+        return pos++ < src.size();
+    }
+
+    bool value(const std::string& key) {
+        skip_ws();
+        if (pos >= src.size()) return false;
+
+        if (src[pos] == '{') {
+            pos++;
+            skip_ws();
+            if (src[pos] == '}') return ++pos, true;
+            while (true) {
+                skip_ws();
+                std::string name;
+                if (!string(name)) return false;
+                skip_ws();
+                if (src[pos++] != ':') return false;
+                if (!value(key.empty() ? name : key + "." + name)) return false;
+                skip_ws();
+                if (src[pos] == ',') { pos++; continue; }
+                return src[pos++] == '}';
+            }
+        }
+        if (src[pos] == '[') {
+            // Arrays are skipped; elements are not addressable by key.
+            pos++;
+            skip_ws();
+            if (src[pos] == ']') return ++pos, true;
+            while (true) {
+                if (!value(key + ".[]")) return false;
+                skip_ws();
+                if (src[pos] == ',') { pos++; continue; }
+                return src[pos++] == ']';
+            }
+        }
+        if (src[pos] == '"') {
+            std::string ignored;
+            return string(ignored);
+        }
+
+        size_t end = pos;
+        while (end < src.size() && (std::isalnum(static_cast<unsigned char>(src[end]))
+               || src[end] == '-' || src[end] == '+' || src[end] == '.'))
+            end++;
+        auto token = src.substr(pos, end - pos);
+        pos = end;
+        if (token == "true" || token == "false" || token == "null") return true;
+        try {
+            numbers[key] = std::stod(token);
+        } catch (...) {
+            return false;
+        }
+        return true;
+    }
+};
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    return buffer.str();
+}
+
+bool parse_ppm(const std::string& text, int& width, int& height, std::vector<int>& pixels) {
+    std::istringstream in(text);
+    std::string magic;
+    int max_value;
+    if (!(in >> magic >> width >> height >> max_value) || magic != "P3") return false;
+
+    pixels.resize(3 * width * height);
+    for (auto& p : pixels)
+        if (!(in >> p)) return false;
+    return true;
+}
+
+double image_rmse(const std::string& rendered, const std::string& reference) {
+    // Root mean square channel difference on [0,1] values, or -1 if the images don't match up.
+    int w0, h0, w1, h1;
+    std::vector<int> a, b;
+    if (!parse_ppm(rendered, w0, h0, a) || !parse_ppm(reference, w1, h1, b)) return -1;
+    if (w0 != w1 || h0 != h1) return -1;
+
+    double sum = 0;
+    for (size_t k = 0; k < a.size(); k++) {
+        double d = (a[k] - b[k]) / 255.0;
+        sum += d*d;
+    }
+    return std::sqrt(sum / a.size());
+}
+
+camera regress_camera() {
+    // Same view as main.cpp, at the fixed regression settings.
+    camera cam;
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = image_width;
+    cam.samples_per_pixel = samples_per_pixel;
+    cam.max_depth         = max_depth;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 80;
+    cam.lookfrom = point3(0,0,6);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0.02;
+    cam.focus_dist    = 10.0;
+
+    cam.seed          = render_seed;
+    cam.show_progress = false;
+    return cam;
+}
+
+int render_child(int index, const std::string& image_path) {
+    // Child side of run_scene(): renders one scene, stores the image and reports the timings
+    // and ray count on stdout.
+    using clock = std::chrono::steady_clock;
+    const auto& scene = builtin_scenes()[index];
+    seed_random(render_seed + index);
+
+    auto build_start = clock::now();
+    hittable_list world = scene.build();
+    auto render_start = clock::now();
+
+    auto cam = regress_camera();
+    std::ofstream image(image_path);
+    cam.render(world, image);
+    auto render_end = clock::now();
+
+    std::cout << std::chrono::duration<double, std::milli>(render_start - build_start).count() << ' '
+              << std::chrono::duration<double, std::milli>(render_end - render_start).count() << ' '
+              << cam.last_rays_traced() << '\n';
+    return image ? 0 : 1;
+}
+
+bool run_scene(int index, std::string& image, scene_result& result) {
+    // Each scene renders in its own process so that its peak RSS (reported by wait4) and its
+    // heap are not polluted by the scenes that ran before it.
+    result.name = builtin_scenes()[index].name;
+    auto image_path = "/tmp/rt_regress_" + std::to_string(getpid()) + "_" + result.name + ".ppm";
+    auto index_arg = std::to_string(index);
+
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl("/proc/self/exe", "ray_tracing_regress", "--child", index_arg.c_str(),
+              image_path.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return false;
+    }
+
+    std::string report;
+    char buffer[256];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+        report.append(buffer, n);
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return false;
+
+    std::istringstream in(report);
+    if (!(in >> result.build_ms >> result.render_ms >> result.rays)) return false;
+    result.mrays_per_s = result.rays / (result.render_ms * 1e3);
+    result.peak_rss_kb = usage.ru_maxrss; // Kilobytes on Linux
+
+    image = read_file(image_path);
+    std::remove(image_path.c_str());
+    return true;
+}
+
+void check_compressed_bvh(int index, scene_result& result) {
+    // The world is one pointer BVH, so this checks the compressed tree sees through it to the
+    // spheres, and that it finds the same closest hits on random rays.
+    seed_random(render_seed + index);
+    hittable_list world = builtin_scenes()[index].build();
+    compressed_bvh tree(world);
+    if (tree.node_bytes() == 0) {
+        result.failures.push_back("compressed bvh has no nodes");
+        return;
+    }
+
+    const int rays = 20000;
+    int mismatches = 0;
+    for (int k = 0; k < rays; k++) {
+        ray r(vec3::random(-15, 15), random_unit_vector());
+        hit_record expected, found;
+        expected.t = found.t = infinity;
+        bool hit_expected = world.hit(r, interval(0.001, infinity), expected);
+        bool hit_found = tree.hit(r, interval(0.001, infinity), found);
+        if (hit_expected != hit_found || found.t != expected.t || found.object != expected.object)
+            mismatches++;
+    }
+    if (mismatches > 0)
+        result.failures.push_back("compressed bvh hits differ");
+
+    // A saved tree must only load against the list it was built for: not against another layout
+    // or seed with the same primitive count.
+    auto path = "/tmp/rt_regress_" + std::to_string(getpid()) + ".cbvh";
+    auto spheres = stress_spheres(2000, 1, false);
+    compressed_bvh(spheres).save(path);
+    if (!compressed_bvh::load(path, spheres))
+        result.failures.push_back("compressed bvh does not reload");
+    if (compressed_bvh::load(path, stress_spheres(2000, 1, true)) || compressed_bvh::load(path, stress_spheres(2000, 2, false)))
+        result.failures.push_back("compressed bvh loads against another scene");
+    std::remove(path.c_str());
+}
+
+void write_results(std::ostream& out, const std::vector<scene_result>& results, bool passed) {
+    out << "{\n  \"settings\": {\"image_width\": " << image_width
+        << ", \"samples_per_pixel\": " << samples_per_pixel
+        << ", \"max_depth\": " << max_depth
+        << ", \"seed\": " << render_seed << "},\n  \"scenes\": [\n";
+    for (size_t k = 0; k < results.size(); k++) {
+        const auto& r = results[k];
+        out << "    {\"name\": \"" << r.name << "\""
+            << ", \"build_ms\": " << r.build_ms
+            << ", \"render_ms\": " << r.render_ms
+            << ", \"rays\": " << r.rays
+            << ", \"mrays_per_s\": " << r.mrays_per_s
+            << ", \"peak_rss_kb\": " << r.peak_rss_kb
+            << ", \"rmse\": " << r.rmse
+            << ", \"status\": \"" << (r.failures.empty() ? "pass" : "fail") << "\""
+            << ", \"failures\": [";
+        for (size_t f = 0; f < r.failures.size(); f++)
+            out << (f ? ", " : "") << "\"" << r.failures[f] << "\"";
+        out << "]}" << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"passed\": " << (passed ? "true" : "false") << "\n}\n";
+}
+
+void write_baseline(const std::string& path, const std::vector<scene_result>& results,
+                    const flat_json& previous, const tolerances& tol) {
+    // Scenes that were not re-run keep their previous baseline entry.
+    std::ofstream out(path);
+    out << "{\n  \"tolerances\": {\"rmse\": " << tol.rmse
+        << ", \"throughput_drop\": " << tol.throughput_drop
+        << ", \"peak_rss_growth\": " << tol.peak_rss_growth << "},\n  \"scenes\": {";
+
+    bool first = true;
+    for (const auto& scene : builtin_scenes()) {
+        auto key = std::string("scenes.") + scene.name + ".";
+        double mrays = previous.get(key + "mrays_per_s", -1);
+        double render_ms = previous.get(key + "render_ms", -1);
+        double rss = previous.get(key + "peak_rss_kb", -1);
+        for (const auto& r : results)
+            if (r.name == scene.name) {
+                mrays = r.mrays_per_s;
+                render_ms = r.render_ms;
+                rss = r.peak_rss_kb;
+            }
+        if (mrays < 0) continue;
+
+        out << (first ? "\n" : ",\n") << "    \"" << scene.name << "\": {\"mrays_per_s\": " << mrays
+            << ", \"render_ms\": " << render_ms
+            << ", \"peak_rss_kb\": " << static_cast<long>(rss) << "}";
+        first = false;
+    }
+    out << "\n  }\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bool update = false;
+    std::string out_path;
+    std::string dir = RT_REGRESS_DIR;
+    std::vector<std::string> only;
+
+    // The children inherit this, so every scene finds its textures in the same place.
+    setenv("RTW_IMAGES", RT_REGRESS_DIR "/../images", 1);
+
+    if (argc == 4 && std::string(argv[1]) == "--child")
+        return render_child(std::stoi(argv[2]), argv[3]);
+
+    for (int k = 1; k < argc; k++) {
+        std::string arg = argv[k];
+        if (arg == "--update")                  update = true;
+        else if (arg == "--out" && k+1 < argc)  out_path = argv[++k];
+        else if (arg == "--dir" && k+1 < argc)  dir = argv[++k];
+        else if (arg[0] != '-')                 only.push_back(arg);
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--update] [--out file] [--dir dir] [scene...]\n";
+            return 2;
+        }
+    }
+
+    flat_json baseline;
+    auto baseline_path = dir + "/baseline.json";
+    auto baseline_text = read_file(baseline_path);
+    if (!baseline_text.empty() && !baseline.parse(baseline_text)) {
+        std::cerr << "ERROR: Could not parse '" << baseline_path << "'.\n";
+        return 2;
+    }
+
+    tolerances tol;
+    tol.rmse            = baseline.get("tolerances.rmse", tol.rmse);
+    tol.throughput_drop = baseline.get("tolerances.throughput_drop", tol.throughput_drop);
+    tol.peak_rss_growth = baseline.get("tolerances.peak_rss_growth", tol.peak_rss_growth);
+
+    std::vector<scene_result> results;
+    bool passed = true;
+    const auto& scenes = builtin_scenes();
+
+    for (size_t index = 0; index < scenes.size(); index++) {
+        const auto& scene = scenes[index];
+        if (!only.empty() && std::find(only.begin(), only.end(), scene.name) == only.end())
+            continue;
+
+        std::clog << "Rendering " << scene.name << "..." << std::flush;
+        std::string image;
+        scene_result result;
+        if (!run_scene(static_cast<int>(index), image, result)) {
+            std::cerr << "\nERROR: Rendering " << scene.name << " failed.\n";
+            return 2;
+        }
+
+        auto reference_path = dir + "/reference/" + scene.name + ".ppm";
+        if (update) {
+            std::ofstream(reference_path) << image;
+        } else {
+            auto key = std::string("scenes.") + scene.name + ".";
+            auto reference = read_file(reference_path);
+
+            result.rmse = reference.empty() ? -1 : image_rmse(image, reference);
+            if (reference.empty())
+                result.failures.push_back("missing reference image");
+            else if (result.rmse < 0)
+                result.failures.push_back("reference image does not match render size");
+            else if (result.rmse > tol.rmse)
+                result.failures.push_back("image rmse above tolerance");
+
+            if (!baseline.has(key + "mrays_per_s"))
+                result.failures.push_back("missing baseline");
+            else {
+                auto base_mrays = baseline.get(key + "mrays_per_s", 0);
+                auto base_rss   = baseline.get(key + "peak_rss_kb", 0);
+                if (result.mrays_per_s < base_mrays * (1 - tol.throughput_drop))
+                    result.failures.push_back("throughput below baseline");
+                if (base_rss > 0 && result.peak_rss_kb > base_rss * (1 + tol.peak_rss_growth))
+                    result.failures.push_back("peak rss above baseline");
+            }
+
+            if (std::string(scene.name) == "random_spheres")
+                check_compressed_bvh(static_cast<int>(index), result);
+        }
+
+        passed = passed && result.failures.empty();
+        std::clog << ' ' << result.render_ms << " ms, " << result.mrays_per_s << " Mrays/s";
+        if (!update)
+            std::clog << ", rmse " << result.rmse << (result.failures.empty() ? " ok" : " FAIL");
+        std::clog << '\n';
+        results.push_back(result);
+    }
+
+    if (update) {
+        write_baseline(baseline_path, results, baseline, tol);
+        std::clog << "Updated " << baseline_path << " and reference images.\n";
+    }
+
+    if (out_path.empty()) {
+        write_results(std::cout, results, passed);
+    } else {
+        std::ofstream out(out_path);
+        write_results(out, results, passed);
+    }
+
+    return passed ? 0 : 1;
+}
@@ -42,6 +42,14 @@ class aabb {
         return x;
     }
 
+    int longest_axis() const {
+        // Returns the index of the longest axis of the bounding box.
+        if (x.size() > y.size())
+            return x.size() > z.size() ? 0 : 2;
+        else
+            return y.size() > z.size() ? 1 : 2;
+    }
+
     bool hit(const ray& r, interval ray_t) const {
         for (int a = 0; a < 3; a++) {
             auto invD = 1 / r.direction()[a];
@@ -65,4 +73,12 @@ class aabb {
     
 };
 
+inline aabb lerp(const aabb& a, const aabb& b, double t) {
+    // The box between a (t = 0) and b (t = 1), each face moving linearly.
+    auto mix = [t](const interval& p, const interval& q) {
+        return interval(p.min + t*(q.min - p.min), p.max + t*(q.max - p.max));
+    };
+    return aabb(mix(a.x, b.x), mix(a.y, b.y), mix(a.z, b.z));
+}
+
 #endif
\ No newline at end of file
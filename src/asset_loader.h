@@ -0,0 +1,58 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <utility>
+
+#include <tbb/task_group.h>
+
+// Asynchronous asset loading during scene construction.
+//
+// While an asset_loader is installed on a thread (asset_loader_scope), assets created there
+// (image textures so far) hand their decoding to the loader's task group and return at once, so
+// decodes run on worker threads in parallel with each other and with the geometry and BVH build
+// that carries on on the building thread. wait() is the join point: nothing may read an asset
+// before it returns. build_scene() does all of this, so its callers get finished scenes.
+
+class asset_loader {
+public:
+    asset_loader() = default;
+    asset_loader(const asset_loader&) = delete;
+    asset_loader& operator=(const asset_loader&) = delete;
+    ~asset_loader() { tasks.wait(); }
+
+    template <typename F>
+    void run(F&& load) { tasks.run(std::forward<F>(load)); }
+
+    void wait() { tasks.wait(); }  // Rethrows the first exception a load threw
+
+    static asset_loader*& current() {
+        thread_local asset_loader* loader = nullptr;
+        return loader;
+    }
+
+private:
+    tbb::task_group tasks;
+};
+
+class asset_loader_scope {
+public:
+    // Makes `loader` the calling thread's current loader until the scope ends.
+    asset_loader_scope(asset_loader& loader) : previous(asset_loader::current()) {
+        asset_loader::current() = &loader;
+    }
+    ~asset_loader_scope() { asset_loader::current() = previous; }
+
+private:
+    asset_loader* previous;
+};
+
+template <typename F>
+void load_asset(F&& load) {
+    // Runs `load` on the current loader if there is one, else right away.
+    if (auto loader = asset_loader::current())
+        loader->run(std::forward<F>(load));
+    else
+        load();
+}
+
+#endif
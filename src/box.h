@@ -0,0 +1,272 @@
+#ifndef BOX_H
+#define BOX_H
+
+#include "constUtilFuncs.h"
+#include "hittable.h"
+#include "material.h"
+#include "sampler.h"
+
+#include <array>
+
+// A solid rectangular box as one primitive, in place of six quads.
+//
+// The box is stored as a center, half sizes and an orthonormal frame (the world axes for an
+// axis-aligned box). A ray is moved into that frame and clipped against the three slabs at once;
+// the slab that clipped last on entry (or first on exit, for rays starting inside) is the face
+// hit. Each face may have its own material; faces are numbered -x, +x, -y, +y, -z, +z in the
+// box's frame. Texture coordinates run from 0 to 1 across each face.
+//
+// As a light, only the emissive faces are sampled, and of those only the ones facing the point
+// being lit, so every light sample lands on a face that can be seen from there.
+
+class box : public hittable {
+  public:
+    enum face { minus_x, plus_x, minus_y, plus_y, minus_z, plus_z };
+
+    box(const point3& a, const point3& b, shared_ptr<material> m)
+      : box(a, b, same_material(m)) {}
+
+    box(const point3& a, const point3& b, const std::array<shared_ptr<material>, 6>& face_materials)
+      : box(0.5 * (a + b), 0.5 * vec3(fabs(b.x() - a.x()), fabs(b.y() - a.y()), fabs(b.z() - a.z())),
+            vec3(1,0,0), vec3(0,1,0), face_materials) {}
+
+    box(const point3& _center, const vec3& _half_size, const vec3& x_axis, const vec3& y_axis,
+        shared_ptr<material> m)
+      : box(_center, _half_size, x_axis, y_axis, same_material(m)) {}
+
+    box(const point3& _center, const vec3& _half_size, const vec3& x_axis, const vec3& y_axis,
+        const std::array<shared_ptr<material>, 6>& face_materials)
+      : center(_center), half_size(_half_size), mats(face_materials)
+    {
+        // The frame is made orthonormal around x_axis; y_axis only needs to be off its line.
+        axes[0] = unit_vector(x_axis);
+        axes[2] = unit_vector(cross(axes[0], y_axis));
+        axes[1] = cross(axes[2], axes[0]);
+        aligned = axes[0].x() == 1 && axes[1].y() == 1 && axes[2].z() == 1;
+
+        for (int f = 0; f < 6; f++) {
+            int a = f / 2;
+            area[f] = 4 * half_size[(a + 1) % 3] * half_size[(a + 2) % 3];
+        }
+
+        bbox = aabb();
+        for (int k = 0; k < 8; k++) {
+            vec3 corner = center;
+            for (int a = 0; a < 3; a++)
+                corner += ((k >> a) & 1 ? 1 : -1) * half_size[a] * axes[a];
+            bbox = aabb(bbox, aabb(corner, corner));
+        }
+        bbox = bbox.pad();
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        RT_STAT(thread_stats().primitive_tests++);
+        auto origin = to_local(r.origin() - center);
+        auto direction = to_local(r.direction());
+        double t_near, t_far;
+        int near_axis, far_axis;
+        if (!clip(origin, direction, t_near, t_far, near_axis, far_axis))
+            return false;
+
+        // Entering face, or the exit face for rays that start inside (or behind ray_t.min).
+        double t;
+        int f;
+        if (ray_t.contains(t_near)) {
+            t = t_near;
+            f = 2 * near_axis + (direction[near_axis] < 0);
+        } else if (ray_t.contains(t_far)) {
+            t = t_far;
+            f = 2 * far_axis + (direction[far_axis] > 0);
+        } else {
+            return false;
+        }
+
+        rec.t = t;
+        rec.p = r.at(t);
+        face_uv(f, origin + t * direction, rec.u, rec.v);
+        rec.mat = mats[f];
+        rec.object = this;
+        rec.set_face_normal(r, outward_normal(f));
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        RT_STAT(thread_stats().primitive_tests++);
+        double t_near, t_far;
+        int near_axis, far_axis;
+        if (!clip(to_local(r.origin() - center), to_local(r.direction()), t_near, t_far, near_axis, far_axis))
+            return false;
+        return ray_t.contains(t_near) || ray_t.contains(t_far);
+    }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        hit_record rec;
+        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+            return 0;
+
+        double faces[6];
+        auto visible = visible_emissive_area(origin, faces);
+        int f = face_of(rec);
+        if (visible <= 0 || faces[f] <= 0)
+            return 0;
+        auto distance_squared = rec.t * rec.t * direction.length_squared();
+        auto cosine = fabs(dot(direction, rec.normal) / direction.length());
+        return distance_squared / (cosine * visible);
+    }
+
+    vec3 random(const point3& origin) const override {
+        double faces[6];
+        auto visible = visible_emissive_area(origin, faces);
+        if (visible <= 0)
+            return center - origin;
+
+        double s, t;
+        sample_2d(s, t);
+        int f = pick_face(faces, visible, s);
+        return point_on_face(f, s, t) - origin;
+    }
+
+    double surface_area() const override {
+        double total = 0;
+        for (int f = 0; f < 6; f++)
+            total += emissive(f) ? area[f] : 0;
+        return total;
+    }
+
+    void sample_surface(double s, double t, hit_record& rec) const override {
+        // Evenly over the emissive faces, which photons leave from.
+        double faces[6];
+        double total = 0;
+        for (int f = 0; f < 6; f++)
+            total += faces[f] = emissive(f) ? area[f] : 0;
+        if (total <= 0)
+            return;
+        int f = pick_face(faces, total, s);
+        rec.p = point_on_face(f, s, t);
+        rec.normal = outward_normal(f);
+        rec.front_face = true;
+        rec.u = s;
+        rec.v = t;
+        rec.mat = mats[f];
+        rec.object = this;
+    }
+
+    void collect_emitters(std::vector<const hittable*>& emitters) const override {
+        for (int f = 0; f < 6; f++)
+            if (emissive(f)) {
+                emitters.push_back(this);
+                return;
+            }
+    }
+
+    emitter_bounds emission_bounds() const override {
+        // Only the outside of a closed box can be seen, so it emits one-sided.
+        emitter_bounds e;
+        e.bounds = bbox;
+        e.cos_theta_o = -1;  // Faces every direction
+        for (int f = 0; f < 6; f++) {
+            if (!emissive(f)) continue;
+            auto radiance = mats[f]->emitted(0.5, 0.5, point_on_face(f, 0.5, 0.5));
+            e.power += (radiance.x() + radiance.y() + radiance.z()) / 3 * area[f] * pi;
+        }
+        return e;
+    }
+
+  private:
+    point3 center;
+    vec3 half_size;
+    vec3 axes[3];          // Orthonormal frame of the box
+    bool aligned = false;  // The frame is the world axes, so moving into it is a translation
+    std::array<shared_ptr<material>, 6> mats;
+    double area[6];
+    aabb bbox;
+
+    static std::array<shared_ptr<material>, 6> same_material(const shared_ptr<material>& m) {
+        return { m, m, m, m, m, m };
+    }
+
+    vec3 to_local(const vec3& v) const {
+        if (aligned) return v;
+        return vec3(dot(v, axes[0]), dot(v, axes[1]), dot(v, axes[2]));
+    }
+
+    bool clip(const vec3& origin, const vec3& direction, double& t_near, double& t_far,
+              int& near_axis, int& far_axis) const {
+        // Intersects the ray (in the box's frame) with the three slabs; the interval between
+        // entering all of them and leaving the first one is [t_near, t_far].
+        t_near = -infinity;
+        t_far = infinity;
+        near_axis = far_axis = 0;
+        for (int a = 0; a < 3; a++) {
+            auto invD = 1 / direction[a];
+            auto t0 = (-half_size[a] - origin[a]) * invD;
+            auto t1 = ( half_size[a] - origin[a]) * invD;
+            if (invD < 0)
+                std::swap(t0, t1);
+            if (t0 > t_near) { t_near = t0; near_axis = a; }
+            if (t1 < t_far)  { t_far = t1;  far_axis = a; }
+        }
+        return t_near <= t_far;
+    }
+
+    bool emissive(int f) const { return mats[f] && mats[f]->is_emissive(); }
+
+    vec3 outward_normal(int f) const { return (f & 1 ? 1.0 : -1.0) * axes[f / 2]; }
+
+    int face_of(const hit_record& rec) const {
+        // The face a hit record from hit() lies on.
+        auto local = to_local(rec.p - center);
+        int f = 0;
+        double best = -infinity;
+        for (int a = 0; a < 3; a++) {
+            auto d = fabs(local[a]) / half_size[a];
+            if (d > best) { best = d; f = 2 * a + (local[a] > 0); }
+        }
+        return f;
+    }
+
+    void face_uv(int f, const vec3& local, double& u, double& v) const {
+        int a = f / 2, b = (a + 1) % 3, c = (a + 2) % 3;
+        u = half_size[b] > 0 ? 0.5 * (local[b] / half_size[b] + 1) : 0.5;
+        v = half_size[c] > 0 ? 0.5 * (local[c] / half_size[c] + 1) : 0.5;
+    }
+
+    point3 point_on_face(int f, double s, double t) const {
+        int a = f / 2, b = (a + 1) % 3, c = (a + 2) % 3;
+        return center + (f & 1 ? 1.0 : -1.0) * half_size[a] * axes[a]
+             + (2*s - 1) * half_size[b] * axes[b] + (2*t - 1) * half_size[c] * axes[c];
+    }
+
+    double visible_emissive_area(const point3& origin, double (&faces)[6]) const {
+        // Areas of the emissive faces whose outside origin is on (0 for the rest), and their sum.
+        auto local = to_local(origin - center);
+        double total = 0;
+        for (int f = 0; f < 6; f++) {
+            int a = f / 2;
+            bool facing = f & 1 ? local[a] > half_size[a] : local[a] < -half_size[a];
+            total += faces[f] = facing && emissive(f) ? area[f] : 0;
+        }
+        return total;
+    }
+
+    static int pick_face(const double (&faces)[6], double total, double& s) {
+        // Chooses a face in proportion to its entry in faces and rescales s to [0,1) within it.
+        auto target = s * total;
+        int last = 0;
+        for (int f = 0; f < 6; f++) {
+            if (faces[f] <= 0) continue;
+            last = f;
+            if (target < faces[f]) {
+                s = target / faces[f];
+                return f;
+            }
+            target -= faces[f];
+        }
+        s = std::min(1.0, target / faces[last]);
+        return last;
+    }
+};
+
+#endif
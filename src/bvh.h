@@ -5,46 +5,38 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "render_trace.h"
 
 #include <algorithm>
+#include <tbb/parallel_invoke.h>
 
 
+// Subtrees over moving primitives are built from motion_bvh_nodes, which also keep their bounds
+// at time 0 and 1 and test a ray against the box interpolated to its time. A fast mover then only
+// widens the tree where it is at that moment rather than along its whole path, while static
+// subtrees keep plain nodes and pay nothing. The root a constructor builds is a plain node, so a
+// tree nested in another counts as static there.
+
+class motion_bvh_node;
+
 class bvh_node : public hittable {
   public:
     bvh_node(const hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
 
     bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
+        RT_TRACE_SCOPE("phase", "BVH build");
         auto objects = src_objects; // Create a modifiable array of the source scene objects
+        build(objects, start, end, true);
+    }
 
-        int axis = random_int(0,2);
-        auto comparator = (axis == 0) ? box_x_compare
-                        : (axis == 1) ? box_y_compare
-                                      : box_z_compare;
-
-        size_t object_span = end - start;
-
-        if (object_span == 1) {
-            left = right = objects[start];
-        } else if (object_span == 2) {
-            if (comparator(objects[start], objects[start+1])) {
-                left = objects[start];
-                right = objects[start+1];
-            } else {
-                left = objects[start+1];
-                right = objects[start];
-            }
-        } else {
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
-
-            auto mid = start + object_span/2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
-        }
-
-        bbox = aabb(left->bounding_box(), right->bounding_box());
+    bvh_node(std::vector<shared_ptr<hittable>>&& objects) {
+        // Takes ownership of the array and partitions it in place, without a copy.
+        RT_TRACE_SCOPE("phase", "BVH build");
+        build(objects, 0, objects.size(), true);
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        RT_STAT(thread_stats().bvh_nodes_visited++);
         if (!bbox.hit(r, ray_t))
             return false;
 
@@ -54,14 +46,87 @@ class bvh_node : public hittable {
         return hit_left || hit_right;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        RT_STAT(thread_stats().bvh_nodes_visited++);
+        if (!bbox.hit(r, ray_t))
+            return false;
+        return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+    }
+
     aabb bounding_box() const override { return bbox; }
 
+    void collect_emitters(std::vector<const hittable*>& emitters) const override {
+        left->collect_emitters(emitters);
+        if (right != left)
+            right->collect_emitters(emitters);
+    }
+
+    bool collect_primitives(std::vector<shared_ptr<hittable>>& primitives) const override {
+        add_primitives(left, primitives);
+        if (right != left)
+            add_primitives(right, primitives);
+        return true;
+    }
+
   private:
+    friend class bvh_optimizer;
+    friend class motion_bvh_node;
+
     shared_ptr<hittable> left;
     shared_ptr<hittable> right;
     aabb bbox;
 
+    bvh_node(shared_ptr<hittable> _left, shared_ptr<hittable> _right)
+      : left(_left), right(_right), bbox(_left->bounding_box(), _right->bounding_box()) {}
+
+    static shared_ptr<hittable> join(shared_ptr<hittable> left, shared_ptr<hittable> right);
+
+    // Spans at least this large build their two halves as parallel tasks.
+    static const size_t parallel_build_span = 4096;
+
+    struct in_place {};
+
+    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, in_place, bool may_move) {
+        build(objects, start, end, may_move);
+    }
+
+    static shared_ptr<hittable> make_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+                                          bool may_move);
+
+    void build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, bool may_move) {
+        // Every node partitions its own span of the shared array, so no level copies it. Unless
+        // may_move is false (a static node's span), children check their span for motion.
+        bbox = aabb();
+        for (size_t i = start; i < end; i++)
+            bbox = aabb(bbox, objects[i]->bounding_box());
+
+        int axis = bbox.longest_axis();
+        auto comparator = (axis == 0) ? box_x_compare
+                        : (axis == 1) ? box_y_compare
+                                      : box_z_compare;
+
+        size_t object_span = end - start;
+
+        if (object_span == 1) {
+            left = right = objects[start];
+        } else if (object_span == 2) {
+            left = objects[start];
+            right = objects[start+1];
+        } else {
+            auto mid = start + object_span/2;
+            std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end,
+                             comparator);
 
+            auto build_left = [&] { left = make_node(objects, start, mid, may_move); };
+            auto build_right = [&] { right = make_node(objects, mid, end, may_move); };
+            if (object_span >= parallel_build_span) {
+                tbb::parallel_invoke(build_left, build_right);
+            } else {
+                build_left();
+                build_right();
+            }
+        }
+    }
 
     static bool box_compare(
         const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index
@@ -82,4 +147,72 @@ class bvh_node : public hittable {
     }
 };
 
+class motion_bvh_node final : public bvh_node {
+  public:
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        RT_STAT(thread_stats().bvh_nodes_visited++);
+        if (!lerp(bbox_start, bbox_end, r.time()).hit(r, ray_t))
+            return false;
+
+        bool hit_left = left->hit(r, ray_t, rec);
+        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+        return hit_left || hit_right;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        RT_STAT(thread_stats().bvh_nodes_visited++);
+        if (!lerp(bbox_start, bbox_end, r.time()).hit(r, ray_t))
+            return false;
+        return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+    }
+
+    bool has_motion() const override { return true; }
+
+    void motion_bounds(aabb& start, aabb& end) const override {
+        start = bbox_start;
+        end = bbox_end;
+    }
+
+  private:
+    friend class bvh_node;
+
+    aabb bbox_start, bbox_end;  // Bounds at time 0 and 1
+
+    motion_bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end)
+      : bvh_node(objects, start, end, in_place(), true)
+    {
+        set_motion_bounds();
+    }
+
+    motion_bvh_node(shared_ptr<hittable> _left, shared_ptr<hittable> _right) : bvh_node(_left, _right) {
+        set_motion_bounds();
+    }
+
+    void set_motion_bounds() {
+        aabb left_start, left_end, right_start, right_end;
+        left->motion_bounds(left_start, left_end);
+        right->motion_bounds(right_start, right_end);
+        bbox_start = aabb(left_start, right_start);
+        bbox_end = aabb(left_end, right_end);
+    }
+};
+
+inline shared_ptr<hittable> bvh_node::make_node(std::vector<shared_ptr<hittable>>& objects, size_t start,
+                                                size_t end, bool may_move) {
+    // A span with a moving primitive gets a motion node; one without can skip the check below.
+    if (may_move)
+        for (size_t i = start; i < end; i++)
+            if (objects[i]->has_motion())
+                return shared_ptr<bvh_node>(new motion_bvh_node(objects, start, end));
+    return shared_ptr<bvh_node>(new bvh_node(objects, start, end, in_place(), false));
+}
+
+inline shared_ptr<hittable> bvh_node::join(shared_ptr<hittable> left, shared_ptr<hittable> right) {
+    // A node over two subtrees, keeping motion bounds if either moves.
+    if (left->has_motion() || right->has_motion())
+        return shared_ptr<bvh_node>(new motion_bvh_node(left, right));
+    return shared_ptr<bvh_node>(new bvh_node(left, right));
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,483 @@
+#ifndef BVH_OPTIMIZER_H
+#define BVH_OPTIMIZER_H
+
+#include "constUtilFuncs.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <queue>
+#include <vector>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+
+// Post-build optimization of a bvh_node hierarchy.
+//
+// The tree is flattened into an array, improved, and rebuilt as new bvh_nodes over the same
+// primitives. There are two passes:
+//
+//  - Treelet restructuring (Karras and Aila, "Fast Parallel Construction of High-Quality
+//    Bounding Volume Hierarchies"). Nodes are visited bottom-up in parallel: a node is processed
+//    by whichever task finishes its second child. Each node grows a treelet of up to 7 leaves by
+//    repeatedly opening its largest-area leaf, then dynamic programming over all subsets of
+//    those leaves finds the topology with the lowest SAH cost, which replaces the old one.
+//  - Reinsertion (after Bittner et al. and Meister and Bittner). The nodes that inflate their
+//    parent the most are detached and reinserted where a branch-and-bound search says the SAH
+//    cost grows least. Searches run in parallel against the current tree; moves are then
+//    applied one by one, skipping any that touch a node an earlier move already changed, and
+//    undone again if the exact cost change (the estimate can be stale) is not a gain.
+//
+// SAH cost here is (1.2 * sum of interior areas + sum of leaf areas) / root area, with one
+// primitive per leaf as bvh_node builds them.
+
+class bvh_optimizer {
+public:
+    struct settings {
+        int treelet_leaves = 7;               // Leaves per treelet, 3 to 7
+        int treelet_passes = 3;
+        int reinsertion_batches = 8;
+        double reinsertion_fraction = 0.01;   // Share of nodes moved per batch
+    };
+
+    struct quality {
+        double sah_cost = 0;
+        double overlap = 0;           // Summed area shared by sibling boxes, over root area
+        int max_depth = 0;
+        double mean_leaf_depth = 0;
+        size_t nodes = 0;
+    };
+
+    explicit bvh_optimizer(const bvh_node& root_node) {
+        nodes.push_back(node());
+        nodes[0].box = root_node.bounding_box();
+        nodes[0].area = half_area(nodes[0].box);
+        if (root_node.left == root_node.right) {
+            nodes[0].object = root_node.left;
+            return;
+        }
+        flatten(0, root_node.left);
+        flatten(0, root_node.right);
+    }
+
+    quality measure() const {
+        quality q;
+        double leaf_depths = 0;
+        size_t leaves = 0;
+        std::vector<std::pair<int, int>> stack = { { root, 0 } };
+        while (!stack.empty()) {
+            auto [index, depth] = stack.back();
+            stack.pop_back();
+            const auto& n = nodes[index];
+            q.nodes++;
+            q.max_depth = std::max(q.max_depth, depth);
+            if (n.leaf()) {
+                q.sah_cost += leaf_cost * n.area;
+                leaf_depths += depth;
+                leaves++;
+                continue;
+            }
+            q.sah_cost += interior_cost * n.area;
+            q.overlap += half_area(intersection(nodes[n.child[0]].box, nodes[n.child[1]].box));
+            stack.push_back({ n.child[0], depth + 1 });
+            stack.push_back({ n.child[1], depth + 1 });
+        }
+        auto root_area = nodes[root].area > 0 ? nodes[root].area : 1;
+        q.sah_cost /= root_area;
+        q.overlap /= root_area;
+        q.mean_leaf_depth = leaves ? leaf_depths / leaves : 0;
+        return q;
+    }
+
+    void restructure_treelets(int passes, int max_leaves) {
+        max_leaves = std::clamp(max_leaves, 3, 7);
+        std::vector<int> leaves;
+        for (int i = 0; i < int(nodes.size()); i++)
+            if (nodes[i].leaf()) leaves.push_back(i);
+
+        for (int pass = 0; pass < passes; pass++) {
+            std::vector<std::atomic<int>> visits(nodes.size());
+            tbb::parallel_for(size_t(0), leaves.size(), [&](size_t l) {
+                int index = leaves[l];
+                nodes[index].cost = leaf_cost * nodes[index].area;
+                for (index = nodes[index].parent; index >= 0; index = nodes[index].parent) {
+                    // The first child to arrive stops; the second one owns the whole subtree.
+                    if (visits[index].fetch_add(1, std::memory_order_acq_rel) == 0)
+                        break;
+                    optimize_treelet(index, max_leaves);
+                }
+            });
+        }
+    }
+
+    void reinsert(int batches, double fraction) {
+        for (int batch = 0; batch < batches; batch++) {
+            // Candidates: nodes whose removal shrinks their parent the most.
+            std::vector<std::pair<double, int>> inflation;
+            for (int i = 0; i < int(nodes.size()); i++) {
+                int parent = nodes[i].parent;
+                if (parent < 0 || parent == root) continue;
+                inflation.push_back({ nodes[parent].area - nodes[sibling(i)].area, i });
+            }
+            size_t count = std::max<size_t>(1, size_t(fraction * nodes.size()));
+            count = std::min(count, inflation.size());
+            if (count == 0) return;
+            std::partial_sort(inflation.begin(), inflation.begin() + count, inflation.end(),
+                              std::greater<std::pair<double, int>>());
+
+            std::vector<move> moves(count);
+            tbb::parallel_for(size_t(0), count, [&](size_t m) {
+                moves[m] = find_move(inflation[m].second);
+            });
+            std::sort(moves.begin(), moves.end(), [](const move& a, const move& b) {
+                return a.gain > b.gain || (a.gain == b.gain && a.node < b.node);
+            });
+
+            std::vector<char> locked(nodes.size(), 0);
+            int applied = 0;
+            for (const auto& m : moves) {
+                if (m.gain <= 0) break;
+                if (apply(m, locked)) applied++;
+            }
+            if (applied == 0) return;
+        }
+    }
+
+    shared_ptr<hittable> build() const {
+        return build(root, 0);
+    }
+
+private:
+    static constexpr double interior_cost = 1.2;
+    static constexpr double leaf_cost = 1.0;
+
+    struct node {
+        aabb box;
+        double area = 0;
+        double cost = 0;                // SAH cost of the subtree, not normalized
+        int parent = -1;
+        int child[2] = { -1, -1 };      // Both -1 for leaves
+        shared_ptr<hittable> object;    // Leaves only
+
+        bool leaf() const { return child[0] < 0; }
+    };
+
+    struct move {
+        int node = -1;
+        int target = -1;    // Node the moved one becomes a sibling of
+        double gain = 0;    // Estimated SAH cost reduction, not normalized
+    };
+
+    std::vector<node> nodes;
+    int root = 0;
+
+    static double half_area(const aabb& box) {
+        double dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        if (dx < 0 || dy < 0 || dz < 0) return 0;
+        return dx*dy + dy*dz + dz*dx;
+    }
+
+    static aabb intersection(const aabb& a, const aabb& b) {
+        return aabb(interval(std::max(a.x.min, b.x.min), std::min(a.x.max, b.x.max)),
+                    interval(std::max(a.y.min, b.y.min), std::min(a.y.max, b.y.max)),
+                    interval(std::max(a.z.min, b.z.min), std::min(a.z.max, b.z.max)));
+    }
+
+    void flatten(int parent, const shared_ptr<hittable>& object) {
+        // Nested bvh_nodes are opened up too; single-object bvh_nodes become plain leaves.
+        auto inner = std::dynamic_pointer_cast<bvh_node>(object);
+        while (inner && inner->left == inner->right) {
+            auto only = inner->left;
+            inner = std::dynamic_pointer_cast<bvh_node>(only);
+            if (!inner) return flatten_leaf(parent, only);
+        }
+        if (!inner) return flatten_leaf(parent, object);
+
+        int index = int(nodes.size());
+        nodes.push_back(node());
+        nodes[index].box = inner->bounding_box();
+        nodes[index].area = half_area(nodes[index].box);
+        attach(parent, index);
+        flatten(index, inner->left);
+        flatten(index, inner->right);
+    }
+
+    void flatten_leaf(int parent, const shared_ptr<hittable>& object) {
+        int index = int(nodes.size());
+        nodes.push_back(node());
+        nodes[index].box = object->bounding_box();
+        nodes[index].area = half_area(nodes[index].box);
+        nodes[index].object = object;
+        attach(parent, index);
+    }
+
+    void attach(int parent, int index) {
+        nodes[index].parent = parent;
+        auto& slots = nodes[parent].child;
+        slots[slots[0] < 0 ? 0 : 1] = index;
+    }
+
+    int sibling(int index) const {
+        const auto& parent = nodes[nodes[index].parent];
+        return parent.child[0] == index ? parent.child[1] : parent.child[0];
+    }
+
+    void refit(int index) {
+        auto& n = nodes[index];
+        n.box = aabb(nodes[n.child[0]].box, nodes[n.child[1]].box);
+        n.area = half_area(n.box);
+    }
+
+    // Treelet restructuring
+
+    void optimize_treelet(int treelet_root, int max_leaves) {
+        auto& top = nodes[treelet_root];
+        top.cost = interior_cost * top.area + nodes[top.child[0]].cost + nodes[top.child[1]].cost;
+
+        int leaves[7] = { top.child[0], top.child[1] };
+        int interiors[6] = { treelet_root };
+        int leaf_count = 2, interior_count = 1;
+        while (leaf_count < max_leaves) {
+            int widest = -1;
+            for (int l = 0; l < leaf_count; l++)
+                if (!nodes[leaves[l]].leaf() && (widest < 0 || nodes[leaves[l]].area > nodes[leaves[widest]].area))
+                    widest = l;
+            if (widest < 0) break;
+            int opened = leaves[widest];
+            interiors[interior_count++] = opened;
+            leaves[widest] = nodes[opened].child[0];
+            leaves[leaf_count++] = nodes[opened].child[1];
+        }
+        if (leaf_count < 3) return;
+
+        // cost[s]: best SAH cost of a subtree over leaf subset s; split[s]: its left half.
+        int full = (1 << leaf_count) - 1;
+        aabb box[128];
+        double area[128], cost[128];
+        int split[128];
+        for (int s = 1; s <= full; s++) {
+            int low = s & -s;
+            int l = lowest_bit(low);
+            box[s] = (s == low) ? nodes[leaves[l]].box : aabb(box[s ^ low], nodes[leaves[l]].box);
+            area[s] = half_area(box[s]);
+            if (s == low) {
+                cost[s] = nodes[leaves[l]].cost;
+                continue;
+            }
+            double best = infinity;
+            for (int part = (s - 1) & s; part; part = (part - 1) & s) {
+                if (!(part & low)) continue;    // Each split once, with the low leaf on the left
+                double c = cost[part] + cost[s ^ part];
+                if (c < best) {
+                    best = c;
+                    split[s] = part;
+                }
+            }
+            cost[s] = interior_cost * area[s] + best;
+        }
+
+        if (cost[full] >= top.cost * (1 - 1e-9))
+            return;
+        int next_interior = 1;
+        rebuild_treelet(full, treelet_root, leaves, interiors, next_interior, box, area, cost, split);
+    }
+
+    static int lowest_bit(int s) {
+        // Index of the lowest set bit of a nonzero leaf subset.
+        int index = 0;
+        while (!(s & 1)) {
+            s >>= 1;
+            index++;
+        }
+        return index;
+    }
+
+    void rebuild_treelet(int s, int index, const int* leaves, const int* interiors, int& next_interior,
+                         const aabb* box, const double* area, const double* cost, const int* split) {
+        int parts[2] = { split[s], s ^ split[s] };
+        for (int k = 0; k < 2; k++) {
+            int child;
+            if ((parts[k] & (parts[k] - 1)) == 0) {
+                child = leaves[lowest_bit(parts[k])];
+            } else {
+                child = interiors[next_interior++];
+                rebuild_treelet(parts[k], child, leaves, interiors, next_interior, box, area, cost, split);
+            }
+            nodes[index].child[k] = child;
+            nodes[child].parent = index;
+        }
+        nodes[index].box = box[s];
+        nodes[index].area = area[s];
+        nodes[index].cost = cost[s];
+    }
+
+    // Reinsertion
+
+    move find_move(int moved) const {
+        // Gain of detaching `moved` (its parent disappears and the ancestors shrink) minus the
+        // cheapest place to put it back, found by branch and bound from the root.
+        move result;
+        result.node = moved;
+        int parent = nodes[moved].parent;
+        int other = sibling(moved);
+
+        double removal_gain = interior_cost * nodes[parent].area;
+        aabb shrunk = nodes[other].box;
+        for (int child = parent, a = nodes[parent].parent; a >= 0; child = a, a = nodes[a].parent) {
+            const auto& n = nodes[a];
+            shrunk = aabb(shrunk, nodes[n.child[0] == child ? n.child[1] : n.child[0]].box);
+            removal_gain += interior_cost * (n.area - half_area(shrunk));
+        }
+
+        const aabb& box = nodes[moved].box;
+        double lower_bound = interior_cost * nodes[moved].area;
+        double best = removal_gain;     // Only moves that gain anything are of interest
+        using entry = std::pair<double, int>;
+        std::priority_queue<entry, std::vector<entry>, std::greater<entry>> queue;
+        queue.push({ 0.0, root });
+        while (!queue.empty()) {
+            auto [inherited, index] = queue.top();
+            queue.pop();
+            if (inherited + lower_bound >= best) break;
+            if (index == moved) continue;
+            if (index == parent) {
+                // The parent goes away; its remaining child takes its place.
+                queue.push({ inherited, other });
+                continue;
+            }
+            const auto& n = nodes[index];
+            double merged = half_area(aabb(n.box, box));
+            double direct = inherited + interior_cost * merged;
+            if (direct < best && index != other) {
+                best = direct;
+                result.target = index;
+            }
+            if (!n.leaf()) {
+                double child_inherited = inherited + interior_cost * (merged - n.area);
+                if (child_inherited + lower_bound < best) {
+                    queue.push({ child_inherited, n.child[0] });
+                    queue.push({ child_inherited, n.child[1] });
+                }
+            }
+        }
+        if (result.target >= 0)
+            result.gain = removal_gain - best;
+        return result;
+    }
+
+    bool apply(const move& m, std::vector<char>& locked) {
+        // Makes the move if it is still valid and really lowers the SAH cost.
+        int moved = m.node, target = m.target;
+        int parent = nodes[moved].parent;
+        if (target < 0 || parent < 0 || parent == root || target == parent) return false;
+        int other = sibling(moved);
+        int grandparent = nodes[parent].parent;
+        int target_parent = nodes[target].parent;
+        for (int index : { moved, target, parent, other, grandparent, target_parent })
+            if (index >= 0 && locked[index]) return false;
+        for (int a = target; a >= 0; a = nodes[a].parent)
+            if (a == moved) return false;   // Would hang the node below itself
+
+        // Only the parent and the ancestors on the two paths change area.
+        std::vector<int> changed = { parent };
+        for (int a = grandparent; a >= 0; a = nodes[a].parent) changed.push_back(a);
+        for (int a = target_parent; a >= 0; a = nodes[a].parent) changed.push_back(a);
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        auto area_sum = [&] {
+            double sum = 0;
+            for (int index : changed) sum += nodes[index].area;
+            return sum;
+        };
+
+        double before = area_sum();
+        relocate(moved, target);
+        if (area_sum() >= before * (1 - 1e-9)) {
+            relocate(moved, other);     // Puts the tree back as it was
+            return false;
+        }
+        for (int index : { moved, target, parent, other, grandparent, target_parent })
+            if (index >= 0) locked[index] = 1;
+        return true;
+    }
+
+    void relocate(int moved, int target) {
+        // Detach: the sibling takes the parent's place, which may be the root's (when undoing a
+        // move that reinserted at the root).
+        int parent = nodes[moved].parent;
+        int other = sibling(moved);
+        int grandparent = nodes[parent].parent;
+        if (grandparent < 0) {
+            root = other;
+        } else {
+            auto& gp = nodes[grandparent];
+            gp.child[gp.child[0] == parent ? 0 : 1] = other;
+        }
+        nodes[other].parent = grandparent;
+        for (int a = grandparent; a >= 0; a = nodes[a].parent) refit(a);
+
+        // Reinsert: the freed parent node joins the target and the moved node.
+        int target_parent = nodes[target].parent;
+        if (target_parent < 0) {
+            root = parent;
+        } else {
+            auto& tp = nodes[target_parent];
+            tp.child[tp.child[0] == target ? 0 : 1] = parent;
+        }
+        nodes[parent].parent = target_parent;
+        nodes[parent].child[0] = target;
+        nodes[parent].child[1] = moved;
+        nodes[target].parent = parent;
+        nodes[moved].parent = parent;
+        for (int a = parent; a >= 0; a = nodes[a].parent) refit(a);
+    }
+
+    shared_ptr<hittable> build(int index, int depth) const {
+        const auto& n = nodes[index];
+        if (n.leaf()) return n.object;
+
+        shared_ptr<hittable> left, right;
+        auto build_left = [&] { left = build(n.child[0], depth + 1); };
+        auto build_right = [&] { right = build(n.child[1], depth + 1); };
+        if (depth < 12) {
+            tbb::parallel_invoke(build_left, build_right);
+        } else {
+            build_left();
+            build_right();
+        }
+        return bvh_node::join(left, right);
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const bvh_optimizer::quality& q) {
+    return out << "SAH cost " << q.sah_cost << ", overlap " << q.overlap << ", depth max "
+               << q.max_depth << " mean " << q.mean_leaf_depth << " (" << q.nodes << " nodes)";
+}
+
+inline void optimize_bvh(hittable_list& world, const bvh_optimizer::settings& settings = {}) {
+    // Replaces every top-level bvh_node of world with an optimized copy, logging how the tree
+    // changed. Hit results are unchanged; only traversal cost goes down.
+    for (auto& object : world.objects) {
+        auto tree = std::dynamic_pointer_cast<bvh_node>(object);
+        if (!tree) continue;
+
+        auto start = std::chrono::steady_clock::now();
+        bvh_optimizer optimizer(*tree);
+        auto before = optimizer.measure();
+        optimizer.restructure_treelets(settings.treelet_passes, settings.treelet_leaves);
+        optimizer.reinsert(settings.reinsertion_batches, settings.reinsertion_fraction);
+        auto after = optimizer.measure();
+        object = optimizer.build();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::clog << "BVH before: " << before << '\n'
+                  << "BVH after:  " << after << '\n'
+                  << "BVH optimized in " << elapsed.count() << " ms\n";
+    }
+}
+
+#endif
@@ -4,18 +4,52 @@
 #include "constUtilFuncs.h"
 
 #include "color.h"
+#include "denoise.h"
+#include "execution_context.h"
 #include "hittable.h"
+#include "light_bvh.h"
 #include "material.h"
+#include "path_guiding.h"
+#include "photon_map.h"
+#include "render_progress.h"
+#include "render_trace.h"
+#include "sampler.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <execution>
+#include <fstream>
+#include <iomanip>
 #include <thread>
 #include <iostream>
-#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <string>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_pipeline.h>
 
 
 
 
+struct tile_footprint {
+    // Distinct objects and materials that camera rays hit first within one image tile.
+    std::vector<const hittable*> objects;
+    std::vector<const material*> materials;
+};
+
+struct deadline_report {
+    // What a time-budgeted render achieved.
+    int    passes = 0;
+    int    samples = 0;              // Samples per pixel in the image
+    double seconds = 0;              // Wall time spent rendering passes, abandoned one included
+    double seconds_per_sample = 0;   // Measured cost of one sample over the whole image
+    double noise = 0;                // RMS standard error of pixel luminance
+    double mean_luminance = 0;
+    bool   overrun = false;          // Passed the deadline: the mandatory first pass was too slow
+};
+
 class camera {
 public:
     double aspect_ratio = 1.0;  // Ratio of image width over height
@@ -34,55 +68,147 @@ public:
     double defocus_angle = 0;  // Variation angle of rays through each pixel
     double focus_dist = 10;    // Distance from camera lookfrom point to plane of perfect focus
 
+    uint64_t seed = 0;          // Base seed; every pixel reseeds its thread's generator from it
+    sampler_type sampling = sampler_type::sobol;  // Sequence for pixel, lens, time and bounce samples
+    bool sample_lights = true;  // Next-event estimation at diffuse surfaces through a light BVH
+    bool path_guiding = false;  // Learn where light comes from, then sample diffuse bounces from it
+    int  guiding_passes = 4;    // Training passes of 1, 2, 4, ... spp before render() (discarded)
+    int  caustic_photons = 0;   // Photons emitted per caustic photon map (0: no photon mapping)
+    int  caustic_passes = 1;    // Photon maps render() spreads its samples over, each with a smaller radius
+    double caustic_radius = 0.05;  // Gathering radius of the first photon map, in world units
+    bool show_progress = true;  // Draw the progress bar on std::clog
+    std::string status_file;    // If set, periodically rewritten with a JSON progress report
+    int  stream_rows_in_flight = 0;  // Rows buffered while streaming output (0: 4 per hardware thread)
+    execution_settings execution;    // Threads, NUMA node and pinning for render() and render_tile()
+    double time_budget = 0;     // Seconds; if set, add sample passes until it runs out (at most
+                                // samples_per_pixel in all) instead of a fixed sample count
+
+    bool denoise = false;        // Filter the finished image with the albedo/normal/depth AOVs
+    denoise_settings denoiser;   // Filter strength and edge-stopping parameters
+    std::string aov_prefix;      // If set, writes <prefix>_albedo/_normal/_depth.ppm
+
+#ifdef RT_STATS
+    std::string stats_heatmap_prefix;  // If set, writes <prefix>_cost.ppm and <prefix>_time.ppm
+#endif
+
     void render(const hittable& world) {
-        initialize();
+        render(world, std::cout);
+    }
 
+    void render(const hittable& world, std::ostream& out) {
+        run_in_context(execution, [&] {
+            RT_TRACE_SCOPE("phase", "render");
+            initialize();
+            prepare_lights(world);
+            prepare_guiding(world);
 
-        // Assuming image_width and image_height are the dimensions of the image
-        std::vector<std::vector<color>> image(image_height, std::vector<color>(image_width));
+            if (time_budget > 0 || (caustic_photons > 0 && caustic_passes > 1)) {
+                render_passes(world, out);
+                return;
+            }
+            prepare_caustics(world, 0);
+
+            // Rows stream out as they finish unless something needs the whole image at once.
+            bool needs_full_image = denoise || !aov_prefix.empty();
+#ifdef RT_STATS
+            needs_full_image = needs_full_image || !stats_heatmap_prefix.empty();
+#endif
+            if (needs_full_image)
+                render_buffered(world, out);
+            else
+                render_streaming(world, out);
+        });
+    }
 
-        // Mutex for synchronization
-        std::mutex mtx;
-        
-        std::clog << "[" << std::string(progress_bar_width, ' ') << "] 0.00%\r";
-        std::clog.flush();
+    uint64_t last_rays_traced() const { return rays_traced; } // Rays traced by the last render
+    const deadline_report& last_deadline() const { return deadline; }  // Of the last timed render
 
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+    int height() const {
+        // Image height implied by image_width and aspect_ratio.
+        int h = static_cast<int>(image_width / aspect_ratio);
+        return (h < 1) ? 1 : h;
+    }
 
-        std::for_each(std::execution::par, image_vertical_iterator.begin(), image_vertical_iterator.end(),
-            [this, &world, &mtx, &image](int j)
-        {
-            std::for_each(std::execution::par_unseq, image_horizontal_iterator.begin(), image_horizontal_iterator.end(),
-                [this, j, &world, &mtx, &image](int i)
-            {
-                color pixel_color(0,0,0);
-                for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
-                }
-                mtx.lock();
-                image[j][i] = pixel_color;
-                mtx.unlock();
+    void render_tile(const hittable& world, int x0, int y0, int x1, int y1,
+                     std::vector<color>& pixels, uint64_t& rays) {
+        // Renders the pixels in [x0,x1) x [y0,y1) into `pixels` (row-major, summed over samples,
+        // not yet divided by samples_per_pixel). Each pixel gets exactly the value render() would
+        // give it, so tiles rendered anywhere can be stitched back into the same image.
+        run_in_context(execution, [&] {
+            prepare(world);
+            int tile_width = x1 - x0;
+            pixels.assign(tile_width * (y1 - y0), color(0,0,0));
+
+            std::vector<int> rows(y1 - y0);
+            std::iota(rows.begin(), rows.end(), y0);
+            std::atomic<uint64_t> ray_count(0);
+
+            std::for_each(std::execution::par, rows.begin(), rows.end(), [&](int j) {
+                RT_TRACE_SCOPE_INDEX("row", "tile row", j);
+                uint64_t row_rays = 0;
+                for (int i = x0; i < x1; i++)
+                    pixels[(j - y0)*tile_width + (i - x0)] = render_pixel(world, i, j, row_rays, nullptr);
+                ray_count += row_rays;
             });
+            rays = ray_count;
+        });
+    }
 
-            // Comment this for no progress bar (The code should run faster)
-            mtx.lock();
-            progress_counter++;
-            progress = static_cast<float>(progress_counter) / static_cast<float>(image_height);
-            int filled_width = static_cast<int>(progress * progress_bar_width);
-            std::clog << "\r[" << std::string(filled_width, '=') << std::string(progress_bar_width - filled_width, ' ') << "] " << std::fixed << std::setprecision(2) << (progress * 100.0) << "%";
-            std::clog.flush();
-            mtx.unlock();
+    void prepare(const hittable& world, const camera* shared = nullptr) {
+        // Sets up for trace_tile(). The light BVH and the photon map only depend on the world, so
+        // a camera already prepared for the same world can be passed as `shared` to lend its
+        // copies. A light BVH, guide or photon map made for this world is kept, so render_tile()
+        // makes it once rather than once per tile. Tiles use a single photon map (caustic_passes
+        // is for render()).
+        initialize();
+        if (sample_lights && shared && shared->lights_world == &world) {
+            lights = shared->lights;
+            lights_world = &world;
+        } else if (sample_lights ? lights_world != &world : !lights.empty()) {
+            prepare_lights(world);
+        }
+        if (!guide || guided_world != &world)
+            prepare_guiding(world);
+        if (shared && shared->caustics_world == &world && shared->caustic_photons == caustic_photons
+            && shared->caustic_radius == caustic_radius && shared->seed == seed) {
+            caustics = shared->caustics;
+            caustics_world = &world;
+        } else if (caustics_world != &world || bool(caustics) != (caustic_photons > 0)) {
+            prepare_caustics(world, 0);
+        }
+    }
 
-        });
+    void forget_prepared() {
+        // Makes the next prepare() rebuild its light BVH, guide and photon map, for a world that
+        // was edited in place since.
+        lights_world = guided_world = caustics_world = nullptr;
+    }
 
-        // Print the image in the correct order
-        for (int j = 0; j < image_height; ++j) {
-            for (int i = 0; i < image_width; ++i) {
-                write_color(std::cout, image[j][i], samples_per_pixel);
-            }
+    void trace_tile(const hittable& world, int x0, int y0, int x1, int y1,
+                    color* image, uint64_t& rays, tile_footprint* footprint = nullptr) const {
+        // Renders [x0,x1) x [y0,y1) on the calling thread into a full-size, row-major image of
+        // sample sums (as render_tile gives them). Needs prepare() first. With a footprint, also
+        // records what the tile's camera rays hit first.
+        RT_TRACE_SCOPE_INDEX("tile", "tile", int64_t(y0) * image_width + x0);
+        for (int j = y0; j < y1; j++)
+            for (int i = x0; i < x1; i++)
+                image[size_t(j) * image_width + i] = render_pixel(world, i, j, rays, nullptr, footprint);
+        if (footprint) {
+            auto dedupe = [](auto& list) {
+                std::sort(list.begin(), list.end());
+                list.erase(std::unique(list.begin(), list.end()), list.end());
+            };
+            dedupe(footprint->objects);
+            dedupe(footprint->materials);
         }
-        std::clog << "\rDone.                 \n";
+    }
+
+    void write_image(std::ostream& out, const std::vector<color>& pixel_sums) const {
+        // Writes a full image of per-pixel sample sums (as produced by render_tile) as PPM.
+        int h = height();
+        out << "P3\n" << image_width << ' ' << h << "\n255\n";
+        for (const auto& pixel : pixel_sums)
+            write_color(out, pixel, samples_per_pixel);
     }
 
 private:
@@ -98,22 +224,122 @@ private:
     std::vector<int> image_horizontal_iterator; //
     std::vector<int> image_vertical_iterator;   //
 
-    int progress_bar_width; // Width of the progress bar
-    int progress_counter;
-    float progress;     // Current progress
+    uint64_t rays_traced = 0;
+    deadline_report deadline;
+
+    struct aov_sample {
+        // Sums over a pixel's samples of what each camera ray hit first.
+        color  albedo;
+        vec3   normal;
+        double depth = 0;
+        double luminance_squared = 0;
+        const hittable* object = nullptr;  // First hit of the latest sample (null: background)
+        const material* mat = nullptr;
+    };
+
+    render_progress progress;  // Row/ray counters and the reporter thread that prints them
+    light_bvh lights;          // Emitters of the world being rendered, when sampling lights
+    const hittable* lights_world = nullptr;  // World the light BVH was built for
+    std::shared_ptr<sd_tree> guide;  // Learned incident light, when path guiding
+    bool guide_training = false;     // Diffuse vertices record into the guide
+    const hittable* guided_world = nullptr;  // World the guide was trained in
+    std::shared_ptr<const photon_map> caustics;  // Caustic photons, when photon mapping
+    const hittable* caustics_world = nullptr;    // World the photons were traced in
+
+    enum class caustic_path {
+        // Where a path stands with respect to the caustic photon map.
+        camera,            // No diffuse vertex yet
+        gathered,          // Just left a diffuse vertex, which gathered photons
+        through_specular,  // Only specular bounces since: the map holds any light found now
+    };
+
+    struct diffuse_vertex {
+        // Where a path left a diffuse surface, for weighting the emission its BSDF ray finds.
+        point3 p;
+        vec3   normal;
+        double bsdf_pdf;
+    };
+
+    void prepare_lights(const hittable& world) {
+        RT_TRACE_SCOPE("phase", "light BVH build");
+        if (sample_lights)
+            lights.build(world);
+        else
+            lights = light_bvh();
+        lights_world = sample_lights ? &world : nullptr;
+    }
 
-    void initialize() {
-        image_height = static_cast<int>(image_width / aspect_ratio);
-        image_height = (image_height < 1) ? 1 : image_height;
+    void prepare_guiding(const hittable& world) {
+        // Trains a fresh guide on discarded passes of 1, 2, 4, ... samples per pixel. Their sample
+        // indices start past samples_per_pixel so they share no samples with the render.
+        guide.reset();
+        guided_world = nullptr;
+        if (!path_guiding || guiding_passes <= 0)
+            return;
+
+        RT_TRACE_SCOPE("phase", "path guiding training");
+        auto start = std::chrono::steady_clock::now();
+        guide = std::make_shared<sd_tree>(world.bounding_box());
+        guide_training = true;
+        int first = samples_per_pixel;
+        for (int pass = 0; pass < guiding_passes; pass++) {
+            int count = 1 << pass;
+            tbb::parallel_for(0, image_height, [&](int j) {
+                RT_TRACE_SCOPE_INDEX("row", "guiding row", j);
+                uint64_t discarded_rays = 0;
+                for (int i = 0; i < image_width; ++i)
+                    render_samples(world, i, j, first, count, discarded_rays, nullptr);
+            });
+            guide->end_pass(pass);
+            first += count;
+        }
+        guide_training = false;
+        guided_world = &world;
+
+        if (show_progress) {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::clog << "Path guiding: " << guiding_passes << " training passes (" << first - samples_per_pixel
+                      << " spp) in " << int(elapsed.count()) << " ms, " << guide->leaf_count()
+                      << " spatial leaves\n";
+        }
+    }
 
-        image_horizontal_iterator.resize(image_width);
-        image_vertical_iterator.resize(image_height);
+    void prepare_caustics(const hittable& world, int pass) {
+        // Traces photon map `pass` of a progressive render (0: the only one otherwise). The old
+        // map goes first, so only one is ever in memory.
+        caustics.reset();
+        caustics_world = nullptr;
+        if (caustic_photons <= 0)
+            return;
+
+        RT_TRACE_SCOPE("phase", "photon map");
+        auto start = std::chrono::steady_clock::now();
+        auto radius = photon_map::radius_for_pass(caustic_radius, pass);
+        caustics = std::make_shared<photon_map>(world, size_t(caustic_photons), radius,
+                                                seed ^ (uint64_t(sampler_detail::hash(pass + 1)) << 16));
+        caustics_world = &world;
+
+        if (show_progress) {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::ostringstream line;
+            line << "Caustics: " << caustics->size() << " of " << caustic_photons << " photons stored ("
+                 << caustics->bytes() / 1024 << " KiB) in " << int(elapsed.count()) << " ms, radius " << radius;
+            log_line(line.str());
+        }
+    }
 
-        for(int i=0; i<image_width; i++)
-            image_horizontal_iterator[i] = i;
-        for(int i=0; i<image_height; i++)
-            image_vertical_iterator[i]=i;
-        
+    void initialize() {
+        image_height = height();
+
+        // The index lists only depend on the image size, so a reused camera keeps them.
+        if (image_horizontal_iterator.size() != static_cast<size_t>(image_width)) {
+            image_horizontal_iterator.resize(image_width);
+            std::iota(image_horizontal_iterator.begin(), image_horizontal_iterator.end(), 0);
+        }
+        if (image_vertical_iterator.size() != static_cast<size_t>(image_height)) {
+            image_vertical_iterator.resize(image_height);
+            std::iota(image_vertical_iterator.begin(), image_vertical_iterator.end(), 0);
+        }
 
         center = lookfrom;
 
@@ -146,10 +372,366 @@ private:
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
 
-        progress_bar_width = 50;
-        progress_counter = 0;
-        progress = 0.0;
+    }
+
+    void render_buffered(const hittable& world, std::ostream& out) {
+        // Keeps every pixel until the end, for the denoiser and the per-pixel AOV/heatmap outputs.
+
+        // Rows are allocated by the task that renders them, so their pages are first touched on
+        // that thread's NUMA node.
+        std::vector<std::vector<color>> image(image_height);
+
+        // First-hit auxiliary buffers, only allocated when something consumes them.
+        bool want_aovs = denoise || !aov_prefix.empty();
+        denoise_buffers aovs = want_aovs ? aov_buffers() : denoise_buffers();
 
+        progress.start(image_height, show_progress, status_file);
+
+#ifdef RT_STATS
+        render_stats_registry::instance().reset();
+        std::vector<float> cost_heatmap(image_width * image_height);
+        std::vector<float> time_heatmap(image_width * image_height);
+#endif
+
+        std::for_each(std::execution::par, image_vertical_iterator.begin(), image_vertical_iterator.end(),
+            [&](int j)
+        {
+            RT_TRACE_SCOPE_INDEX("row", "row", j);
+            std::atomic<uint64_t> row_rays(0);
+            image[j].resize(image_width);
+            std::for_each(std::execution::par_unseq, image_horizontal_iterator.begin(), image_horizontal_iterator.end(),
+                [&, j](int i)
+            {
+                auto pixel_start = std::chrono::steady_clock::now();
+#ifdef RT_STATS
+                auto& stats = thread_stats();
+                auto cost_before = stats.traversal_cost();
+#endif
+                uint64_t pixel_rays = 0;
+                aov_sample aov;
+                color pixel_color = render_pixel(world, i, j, pixel_rays, want_aovs ? &aov : nullptr);
+                row_rays += pixel_rays;
+                if (want_aovs)
+                    store_aovs(aovs, j*image_width + i, aov, pixel_color, samples_per_pixel);
+#ifdef RT_STATS
+                std::chrono::duration<float, std::micro> pixel_time =
+                    std::chrono::steady_clock::now() - pixel_start;
+                cost_heatmap[j*image_width + i] = float(stats.traversal_cost() - cost_before);
+                time_heatmap[j*image_width + i] = pixel_time.count();
+#endif
+                image[j][i] = pixel_color;  // Every pixel has exactly one writer
+                progress.add_busy_time(std::chrono::steady_clock::now() - pixel_start);
+            });
+
+            progress.row_done(row_rays);
+        });
+        progress.finish();
+
+        finish_image(out, aovs, samples_per_pixel,
+                     [&](size_t k) { return image[k / image_width][k % image_width]; });
+        rays_traced = progress.rays_traced();
+
+#ifdef RT_STATS
+        render_stats_registry::instance().collect().print(std::clog);
+        if (!stats_heatmap_prefix.empty()) {
+            write_heatmap(stats_heatmap_prefix + "_cost.ppm", cost_heatmap, image_width, image_height);
+            write_heatmap(stats_heatmap_prefix + "_time.ppm", time_heatmap, image_width, image_height);
+        }
+#endif
+    }
+
+    void render_passes(const hittable& world, std::ostream& out) {
+        // Whole-image sample passes, summed per pixel. Pass p < caustic_passes traces photon map p
+        // first, each with a smaller radius than the last (progressive photon mapping); later
+        // passes keep the last map.
+        //
+        // Without a time budget, samples_per_pixel is split evenly over caustic_passes passes.
+        // With one, passes are added until time_budget is spent. The first pass, one sample per
+        // pixel, always completes so there is an image. Each later pass is sized from the measured
+        // cost of the one before: doubling the sample count while that fits (Sobol is best at
+        // power-of-two counts), otherwise taking what does. A pass that runs past the deadline
+        // anyway stops starting rows and is dropped, so the image keeps the last complete count.
+        // Progress counts the rows of the passes started so far; AOVs and the denoiser see the
+        // samples of the complete passes.
+        using clock = std::chrono::steady_clock;
+        auto begin = clock::now();
+        auto end = begin + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(time_budget));
+        auto seconds_until = [](clock::time_point t) {
+            return std::chrono::duration<double>(t - clock::now()).count();
+        };
+
+        bool timed = time_budget > 0;
+        size_t pixels = size_t(image_width) * image_height;
+        bool want_aovs = denoise || !aov_prefix.empty();
+        std::vector<color> sums(pixels, color(0,0,0)), pass(pixels);
+        std::vector<double> luminance_squared(pixels, 0.0), pass_luminance_squared(pixels);
+        std::vector<aov_sample> aov_sums(want_aovs ? pixels : 0), pass_aovs(want_aovs ? pixels : 0);
+        deadline_report report;
+        int limit = std::max(samples_per_pixel, 1);
+        int fixed_passes = std::max(1, std::min(caustic_passes, samples_per_pixel));
+        int count = timed ? 1 : samples_per_pixel / fixed_passes;
+        int photon_maps = std::max(caustic_passes, 1);
+
+        progress.start(timed ? image_height : image_height * fixed_passes, show_progress, status_file);
+        while (count > 0) {
+            if (report.passes < photon_maps)
+                prepare_caustics(world, report.passes);
+            auto pass_start = clock::now();
+            bool must_finish = !timed || report.passes == 0;
+            std::atomic<bool> abandoned(false);
+            std::atomic<int> rows_skipped(0);
+            tbb::parallel_for(0, image_height, [&](int j) {
+                if (!must_finish && (abandoned || clock::now() > end)) {
+                    abandoned = true;
+                    rows_skipped++;
+                    return;
+                }
+                RT_TRACE_SCOPE_INDEX("row", "row", j);
+                auto row_start = clock::now();
+                uint64_t row_rays = 0;
+                for (int i = 0; i < image_width; ++i) {
+                    auto k = size_t(j) * image_width + i;
+                    aov_sample aov;
+                    pass[k] = render_samples(world, i, j, report.samples, count, row_rays, &aov);
+                    pass_luminance_squared[k] = aov.luminance_squared;
+                    if (want_aovs)
+                        pass_aovs[k] = aov;
+                }
+                progress.add_busy_time(clock::now() - row_start);
+                progress.row_done(row_rays);
+            });
+            if (abandoned) {
+                progress.add_rows(-rows_skipped);
+                break;
+            }
+
+            for (size_t k = 0; k < pixels; k++) {
+                sums[k] += pass[k];
+                luminance_squared[k] += pass_luminance_squared[k];
+                if (want_aovs) {
+                    aov_sums[k].albedo += pass_aovs[k].albedo;
+                    aov_sums[k].normal += pass_aovs[k].normal;
+                    aov_sums[k].depth  += pass_aovs[k].depth;
+                    aov_sums[k].luminance_squared = luminance_squared[k];
+                }
+            }
+            report.passes++;
+            report.samples += count;
+            report.seconds_per_sample = -seconds_until(pass_start) / count;
+            report.overrun = report.overrun || seconds_until(end) < 0;
+            if (show_progress) {
+                std::ostringstream line;
+                line << "Pass " << report.passes << ": " << count << " spp in "
+                     << int(1000 * report.seconds_per_sample * count) << " ms, "
+                     << report.samples << " spp total";
+                log_line(line.str());
+            }
+
+            if (!timed) {
+                count = report.passes < fixed_passes
+                      ? samples_per_pixel * (report.passes + 1) / fixed_passes - report.samples : 0;
+                continue;
+            }
+            // Keep a tenth of what is left as margin for the estimate being off.
+            auto affordable = 0.9 * seconds_until(end) / report.seconds_per_sample;
+            count = int(std::min({ double(report.samples), affordable, double(limit - report.samples) }));
+            if (count > 0)
+                progress.add_rows(image_height);
+        }
+        progress.finish();
+        report.seconds = -seconds_until(begin);
+        if (photon_maps > 1) {
+            caustics.reset();
+            caustics_world = nullptr;
+        }
+
+        // Noise: each pixel's sample variance of luminance over its sample count, RMS over pixels.
+        double error_sum = 0, luminance_sum = 0;
+        for (size_t k = 0; k < pixels; k++) {
+            auto n = double(report.samples);
+            auto mean = (sums[k].x() + sums[k].y() + sums[k].z()) / (3 * n);
+            auto variance = fmax(luminance_squared[k] / n - mean * mean, 0.0);
+            error_sum += variance / n;
+            luminance_sum += mean;
+        }
+        report.noise = sqrt(error_sum / pixels);
+        report.mean_luminance = luminance_sum / pixels;
+        if (timed)
+            deadline = report;
+
+        denoise_buffers aovs = want_aovs ? aov_buffers() : denoise_buffers();
+        if (want_aovs)
+            for (size_t k = 0; k < pixels; k++)
+                store_aovs(aovs, k, aov_sums[k], sums[k], report.samples);
+        finish_image(out, aovs, report.samples, [&](size_t k) { return sums[k]; });
+        rays_traced = progress.rays_traced();
+    }
+
+    void render_streaming(const hittable& world, std::ostream& out) {
+        // Rows are rendered in parallel but written strictly in order, each as soon as every row
+        // above it is out. At most rows_in_flight rows exist at any time (being rendered or
+        // waiting for their turn), so memory stays flat however tall the image is.
+        size_t rows_in_flight = stream_rows_in_flight > 0
+            ? stream_rows_in_flight : 4 * std::max(1, tbb::this_task_arena::max_concurrency());
+        int next_row = 0;
+
+        progress.start(image_height, show_progress, status_file);
+
+        out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+
+#ifdef RT_STATS
+        render_stats_registry::instance().reset();
+#endif
+
+        tbb::parallel_pipeline(rows_in_flight,
+            tbb::make_filter<void, int>(tbb::filter_mode::serial_in_order,
+                [&](tbb::flow_control& fc) {
+                    if (next_row == image_height) {
+                        fc.stop();
+                        return 0;
+                    }
+                    return next_row++;
+                })
+            & tbb::make_filter<int, std::string>(tbb::filter_mode::parallel,
+                [&](int j) {
+                    // Formatting happens here too, so the ordered stage only copies bytes.
+                    RT_TRACE_SCOPE_INDEX("row", "row", j);
+                    auto row_start = std::chrono::steady_clock::now();
+                    std::ostringstream row;
+                    uint64_t row_rays = 0;
+                    for (int i = 0; i < image_width; ++i)
+                        write_color(row, render_pixel(world, i, j, row_rays, nullptr), samples_per_pixel);
+                    progress.add_busy_time(std::chrono::steady_clock::now() - row_start);
+                    progress.row_done(row_rays);
+                    return row.str();
+                })
+            & tbb::make_filter<std::string, void>(tbb::filter_mode::serial_in_order,
+                [&](const std::string& row) {
+                    RT_TRACE_SCOPE("output", "write row");
+                    out << row;
+                    out.flush();
+                }));
+        progress.finish();
+
+        rays_traced = progress.rays_traced();
+
+#ifdef RT_STATS
+        render_stats_registry::instance().collect().print(std::clog);
+#endif
+    }
+
+    color render_pixel(const hittable& world, int i, int j, uint64_t& rays, aov_sample* aov,
+                       tile_footprint* footprint = nullptr) const {
+        return render_samples(world, i, j, 0, samples_per_pixel, rays, aov, footprint);
+    }
+
+    color render_samples(const hittable& world, int i, int j, int first, int count, uint64_t& rays,
+                         aov_sample* aov, tile_footprint* footprint = nullptr) const {
+        // Sums samples [first, first+count) of a pixel. Sobol and blue-noise passes continue one
+        // sequence; later passes reseed the generator so they don't repeat the first pass.
+        // Seeding per pixel makes the image independent of thread scheduling.
+        uint64_t pixel_index = (seed << 32) ^ (uint64_t(j) * image_width + i);
+        seed_random(first == 0 ? pixel_index : pixel_index ^ (uint64_t(sampler_detail::hash(first)) << 32));
+
+        auto pixel_sampler = make_sampler(sampling, i, j,
+            sampler_detail::hash_combine(uint32_t(pixel_index >> 32), uint32_t(pixel_index)),
+            uint32_t(seed ^ (seed >> 32)), count);
+        sampler_scope scope(*pixel_sampler);
+
+        aov_sample footprint_aov;
+        if (footprint && !aov)
+            aov = &footprint_aov;
+
+        color pixel_color(0,0,0);
+        for (int sample = first; sample < first + count; ++sample) {
+            pixel_sampler->start_sample(sample);
+            ray r = get_ray(i, j);
+            auto sample_color = ray_color(r, max_depth, world, rays, aov);
+            pixel_color += sample_color;
+            if (aov) {
+                auto lum = (sample_color.x() + sample_color.y() + sample_color.z()) / 3;
+                aov->luminance_squared += lum * lum;
+            }
+            if (footprint && aov->object) {
+                if (footprint->objects.empty() || footprint->objects.back() != aov->object)
+                    footprint->objects.push_back(aov->object);
+                if (footprint->materials.empty() || footprint->materials.back() != aov->mat)
+                    footprint->materials.push_back(aov->mat);
+            }
+        }
+        return pixel_color;
+    }
+
+    void log_line(const std::string& line) const {
+        // A line of its own on std::clog, over whatever the progress bar last drew.
+        std::clog << '\r' << std::left << std::setw(100) << line << std::right << '\n';
+    }
+
+    denoise_buffers aov_buffers() const {
+        denoise_buffers aovs;
+        aovs.width = image_width;
+        aovs.height = image_height;
+        aovs.albedo.resize(image_width * image_height);
+        aovs.normal.resize(image_width * image_height);
+        aovs.depth.resize(image_width * image_height);
+        aovs.variance.resize(image_width * image_height);
+        return aovs;
+    }
+
+    static void store_aovs(denoise_buffers& aovs, size_t k, const aov_sample& aov, const color& pixel_sum,
+                           int samples) {
+        // Pixel k's mean first-hit AOVs and the variance of its mean luminance, from sums over
+        // `samples` samples.
+        aovs.albedo[k] = aov.albedo / samples;
+        aovs.normal[k] = aov.normal / samples;
+        aovs.depth[k]  = aov.depth / samples;
+
+        auto mean = (pixel_sum.x() + pixel_sum.y() + pixel_sum.z()) / (3 * samples);
+        auto variance = aov.luminance_squared / samples - mean * mean;
+        aovs.variance[k] = fmax(variance, 0.0) / samples;
+    }
+
+    template <typename PixelSum>
+    void finish_image(std::ostream& out, denoise_buffers& aovs, int samples, PixelSum&& pixel_sum) const {
+        // Writes the AOVs if asked for, then the image of pixel_sum(k) (row-major sums over
+        // `samples` samples), through the denoiser if it is on. aovs must be filled for either.
+        RT_TRACE_SCOPE("phase", "output");
+        if (!aov_prefix.empty())
+            write_aovs(aovs);
+
+        out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+        size_t pixels = size_t(image_width) * image_height;
+        if (denoise) {
+            aovs.beauty.resize(pixels);
+            for (size_t k = 0; k < pixels; k++)
+                aovs.beauty[k] = pixel_sum(k) / samples;
+
+            auto filtered = denoise_atrous(aovs, denoiser);
+            for (auto& pixel : filtered)
+                write_color(out, pixel, 1);
+        } else {
+            for (size_t k = 0; k < pixels; k++)
+                write_color(out, pixel_sum(k), samples);
+        }
+    }
+
+    void write_aovs(const denoise_buffers& aovs) const {
+        // Albedo as is, normals mapped from [-1,1] to [0,1], depth scaled by its maximum.
+        double max_depth_seen = *std::max_element(aovs.depth.begin(), aovs.depth.end());
+        double depth_scale = max_depth_seen > 0 ? 1.0 / max_depth_seen : 1.0;
+
+        std::ofstream albedo_out(aov_prefix + "_albedo.ppm");
+        std::ofstream normal_out(aov_prefix + "_normal.ppm");
+        std::ofstream depth_out(aov_prefix + "_depth.ppm");
+        for (auto* f : {&albedo_out, &normal_out, &depth_out})
+            *f << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+
+        for (size_t k = 0; k < aovs.albedo.size(); k++) {
+            write_color(albedo_out, aovs.albedo[k], 1);
+            write_color(normal_out, 0.5 * (aovs.normal[k] + vec3(1,1,1)), 1);
+            auto d = aovs.depth[k] * depth_scale;
+            write_color(depth_out, color(d, d, d), 1);
+        }
     }
 
     ray get_ray(int i, int j) const {
@@ -163,43 +745,186 @@ private:
         auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
         auto ray_direction = pixel_sample - ray_origin;
 
-        auto ray_time = random_double();
+        auto ray_time = sample_1d();
 
         return ray(ray_origin, ray_direction, ray_time);
     }
 
     vec3 pixel_sample_square() const {
         // Returns a random point in the square surrounding a pixel at the origin.
-        auto px = -0.5 + random_double();
-        auto py = -0.5 + random_double();
+        double px, py;
+        sample_2d(px, py);
+        px -= 0.5;
+        py -= 0.5;
         return (px * pixel_delta_u) + (py * pixel_delta_v);
     }
 
     point3 defocus_disk_sample() const {
         // Returns a random point in the camera defocus disk.
-        auto p = random_in_unit_disk();
+        auto p = sample_in_unit_disk();
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world) const {
+    static double power_heuristic(double pdf, double other_pdf) {
+        return pdf*pdf / (pdf*pdf + other_pdf*other_pdf);
+    }
+
+    static double guided_pdf(const directional_tree* guided, const vec3& direction, const vec3& normal,
+                             double bsdf_pdf) {
+        // Density of a diffuse bounce direction: the BSDF's alone, or its mix with the guide's.
+        if (!guided)
+            return bsdf_pdf;
+        return sd_tree::guided_fraction * guided->pdf(direction, normal) + (1 - sd_tree::guided_fraction) * bsdf_pdf;
+    }
+
+    color sample_light(const hit_record& rec, const ray& r_in, const color& albedo,
+                       const hittable& world, uint64_t& rays, const directional_tree* guided) const {
+        // Next-event estimation at a diffuse vertex: pick a light with the light BVH and a point
+        // on it, and add its contribution if nothing blocks it, weighted against the chance that
+        // the bounce ray (BSDF or guided) would have found the same light.
+        const hittable* light;
+        double pick_pdf;
+        auto u = sample_1d();
+        if (!lights.sample(rec.p, rec.normal, u, light, pick_pdf))
+            return color(0,0,0);
+
+        auto direction = light->random(rec.p);
+        auto length = direction.length();
+        auto cosine = length > 0 ? dot(rec.normal, direction) / length : 0.0;
+        if (cosine <= 0)
+            return color(0,0,0);
+        auto light_pdf = pick_pdf * light->pdf_value(rec.p, direction);
+        if (light_pdf <= 0)
+            return color(0,0,0);
+
+        // Find the point on the light, then ask only whether anything lies in front of it.
+        ray shadow_ray(rec.p, direction, r_in.time());
+        hit_record on_light;
+        if (!light->hit(shadow_ray, interval(0.001, infinity), on_light))
+            return color(0,0,0);
+        rays++;
+        RT_STAT(thread_stats().shadow_rays++);
+        if (world.occluded(shadow_ray, interval(0.001, on_light.t * (1 - 1e-6))))
+            return color(0,0,0);
+
+        auto bsdf_pdf = cosine / pi;
+        auto radiance = on_light.mat->emitted(on_light.u, on_light.v, on_light.p);
+        return albedo * radiance * (bsdf_pdf / light_pdf)
+             * power_heuristic(light_pdf, guided_pdf(guided, direction, rec.normal, bsdf_pdf));
+    }
+
+    color guided_bounce(const ray& r, const hit_record& rec, const color& albedo, ray scattered,
+                        int depth, const hittable& world, uint64_t& rays, caustic_path path) const {
+        // A diffuse vertex under path guiding: the bounce direction comes from the learned
+        // distribution or the cosine lobe (already sampled by the material), and is weighted by
+        // their mixed density. While training, what the bounce brings back is recorded.
+        const directional_tree* guided = guide->distribution(rec.p);
+        if (guided && random_double() < sd_tree::guided_fraction) {
+            double u1, u2;
+            sample_scatter_2d(u1, u2);
+            scattered = ray(rec.p, guided->sample(u1, u2, rec.normal), r.time());
+        }
+
+        auto direction = scattered.direction();
+        auto cosine = fmax(0.0, dot(rec.normal, direction) / direction.length());
+        auto pdf = guided_pdf(guided, direction, rec.normal, cosine / pi);
+        bool next_event = !lights.empty() && depth > 1;
+        color color_from_light = next_event ? sample_light(rec, r, albedo, world, rays, guided) : color(0,0,0);
+        if (cosine <= 0 || pdf <= 0)
+            return color_from_light;
+
+        diffuse_vertex here{ rec.p, rec.normal, pdf };
+        color incoming = ray_color(scattered, depth-1, world, rays, nullptr, next_event ? &here : nullptr, path);
+        if (guide_training)
+            guide->record(rec.p, direction, (incoming.x() + incoming.y() + incoming.z()) / (3 * pdf));
+        return color_from_light + albedo * incoming * (cosine / pi / pdf);
+    }
+
+    color ray_color(const ray& r, int depth, const hittable& world, uint64_t& rays,
+                    aov_sample* aov = nullptr, const diffuse_vertex* from = nullptr,
+                    caustic_path path = caustic_path::camera) const {
         hit_record rec;
 
         // If we've exceeded the ray bounce limit, no more light is gathered.
-        if (depth <= 0)
+        if (depth <= 0) {
+            RT_STAT(thread_stats().paths_max_depth++);
             return color(0,0,0);
+        }
+
+        rays++;
+        RT_STAT(thread_stats().count_ray(max_depth - depth));
 
         // If the ray hits nothing, return the background color.
-        if (!world.hit(r, interval(0.001, infinity), rec))
+        if (!world.hit(r, interval(0.001, infinity), rec)) {
+            RT_STAT(thread_stats().paths_escaped++);
+            if (aov) {
+                aov->albedo += color(fmin(background.x(), 1.0), fmin(background.y(), 1.0),
+                                     fmin(background.z(), 1.0));
+                aov->object = nullptr;
+                aov->mat = nullptr;
+            }
             return background;
+        }
+
+        if (aov) {
+            aov->albedo += rec.mat->aov_albedo(rec);
+            aov->normal += rec.normal;
+            aov->depth  += rec.t * r.direction().length();
+            aov->object  = rec.object;
+            aov->mat     = rec.mat.get();
+        }
+
+        // Scattering decisions at this vertex draw from this bounce's sampler dimensions.
+        if (auto s = current_sampler())
+            s->start_bounce(max_depth - depth);
 
         ray scattered;
         color attenuation;
         color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
 
-        if (!rec.mat->scatter(r, rec, attenuation, scattered))
+        // Light reached through specular bounces from the gathering vertex is in the photon map.
+        if (path == caustic_path::through_specular)
+            color_from_emission = color(0,0,0);
+
+        // A light found by a diffuse vertex's BSDF ray could also have been light sampled there.
+        if (from && rec.mat->is_emissive()) {
+            auto light_pdf = lights.pmf(from->p, from->normal, rec.object)
+                           * rec.object->pdf_value(from->p, r.direction());
+            color_from_emission = color_from_emission * power_heuristic(from->bsdf_pdf, light_pdf);
+        }
+
+        if (!rec.mat->scatter(r, rec, attenuation, scattered)) {
+            RT_STAT(thread_stats().paths_absorbed++);
             return color_from_emission;
+        }
+
+        // Diffuse vertices add the caustics arriving there, as if emitted.
+        auto next = path;
+        if (caustics) {
+            if (rec.mat->is_diffuse()) {
+                color_from_emission += caustics->radiance(rec.p, rec.normal, attenuation);
+                next = caustic_path::gathered;
+            } else if (path == caustic_path::gathered) {
+                next = caustic_path::through_specular;
+            }
+        }
+
+        if (guide && rec.mat->is_diffuse())
+            return color_from_emission + guided_bounce(r, rec, attenuation, scattered, depth, world, rays, next);
+
+        // Light sampling stops a bounce early so both strategies cover the same path lengths.
+        if (!lights.empty() && depth > 1 && rec.mat->is_diffuse()) {
+            color color_from_light = sample_light(rec, r, attenuation, world, rays, nullptr);
+
+            auto direction = scattered.direction();
+            diffuse_vertex here{ rec.p, rec.normal,
+                                 fmax(0.0, dot(rec.normal, direction) / direction.length()) / pi };
+            color color_from_scatter =
+                attenuation * ray_color(scattered, depth-1, world, rays, nullptr, &here, next);
+            return color_from_emission + color_from_light + color_from_scatter;
+        }
 
-        color color_from_scatter = attenuation * ray_color(scattered, depth-1, world);
+        color color_from_scatter = attenuation * ray_color(scattered, depth-1, world, rays, nullptr, nullptr, next);
 
         return color_from_emission + color_from_scatter;
     }
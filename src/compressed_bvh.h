@@ -0,0 +1,475 @@
+#ifndef COMPRESSED_BVH_H
+#define COMPRESSED_BVH_H
+
+#include "constUtilFuncs.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// BVH with 20-byte nodes that can live in a memory-mapped file.
+//
+// Each node stores the bounds of its two children quantized to 8 bits per coordinate, relative
+// to the node's own bounds as decoded from its parent (the root's bounds are kept at full
+// precision), plus two 32-bit child references. A reference with the top bit set is a leaf and
+// names one primitive by its index in the list the tree was built over, after nested lists and
+// BVHs in it are flattened down to their leaf primitives. Quantization rounds
+// outwards, so decoded bounds always contain the exact ones and traversal stays correct; they
+// are just a little looser.
+//
+// A tree saved with save() can be opened with load() against the same primitive list; its nodes
+// are then mapped read-only from the file and paged in by the OS on demand, so only the nodes a
+// render actually touches take up memory. The file records a fingerprint of the primitives'
+// bounding boxes in order, and load() refuses a tree saved for any other list. Trees are at most max_depth interior levels deep, which
+// sizes the traversal stack; load() rejects files that break that or index out of range.
+
+class compressed_bvh : public hittable {
+public:
+    struct packed_node {
+        uint8_t  lo[2][3];   // Per child: quantized minimum corner
+        uint8_t  hi[2][3];   // Per child: quantized maximum corner
+        uint32_t child[2];   // Interior node index, or leaf_bit | primitive index
+    };
+    static_assert(sizeof(packed_node) == 20, "packed_node must stay 20 bytes");
+
+    static const uint32_t leaf_bit = 0x80000000u;
+    static const uint32_t no_root  = 0xffffffffu;
+    static const int max_depth = 64;
+
+    compressed_bvh(const hittable_list& list) : primitives(flatten(list)) {
+        build();
+        nodes = storage.data();
+    }
+
+    ~compressed_bvh() {
+        if (mapping) munmap(mapping, mapping_size);
+    }
+
+    compressed_bvh(const compressed_bvh&) = delete;
+    compressed_bvh& operator=(const compressed_bvh&) = delete;
+
+    static shared_ptr<compressed_bvh> load(const std::string& path, const hittable_list& list) {
+        // Maps a tree written by save(). Returns null if the file is missing, malformed or was
+        // built over a different primitive list.
+        auto objects = flatten(list);
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+
+        struct stat info;
+        file_header header;
+        bool ok = fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(header)
+               && read(fd, &header, sizeof(header)) == ssize_t(sizeof(header))
+               && memcmp(header.magic, file_magic, sizeof(header.magic)) == 0
+               && header.primitive_count == objects.size()
+               && header.fingerprint == fingerprint(objects)
+               && size_t(info.st_size) == sizeof(header) + size_t(header.node_count) * sizeof(packed_node);
+        void* mapping = ok ? mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (mapping == MAP_FAILED) return nullptr;
+
+        shared_ptr<compressed_bvh> tree(new compressed_bvh(std::move(objects)));
+        tree->mapping = mapping;
+        tree->mapping_size = info.st_size;
+        tree->nodes = reinterpret_cast<const packed_node*>(static_cast<const char*>(mapping) + sizeof(header));
+        tree->node_count = header.node_count;
+        tree->root = header.root;
+        if (!tree->valid())
+            return nullptr;
+        tree->bbox = aabb(interval(header.bounds[0], header.bounds[3]),
+                          interval(header.bounds[1], header.bounds[4]),
+                          interval(header.bounds[2], header.bounds[5]));
+        return tree;
+    }
+
+    bool save(const std::string& path) const {
+        file_header header;
+        memcpy(header.magic, file_magic, sizeof(header.magic));
+        header.node_count = node_count;
+        header.primitive_count = uint32_t(primitives.size());
+        header.root = root;
+        header.fingerprint = fingerprint(primitives);
+        double bounds[6] = { bbox.x.min, bbox.y.min, bbox.z.min, bbox.x.max, bbox.y.max, bbox.z.max };
+        memcpy(header.bounds, bounds, sizeof(bounds));
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(nodes), std::streamsize(node_count) * sizeof(packed_node));
+        return bool(out);
+    }
+
+    size_t node_bytes() const { return size_t(node_count) * sizeof(packed_node); }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return traverse<false>(r, ray_t, &rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return traverse<true>(r, ray_t, nullptr);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void collect_emitters(std::vector<const hittable*>& emitters) const override {
+        for (const auto& object : primitives)
+            object->collect_emitters(emitters);
+    }
+
+    bool collect_primitives(std::vector<shared_ptr<hittable>>& list) const override {
+        for (const auto& object : primitives)
+            add_primitives(object, list);
+        return true;
+    }
+
+private:
+    template <bool any_hit>
+    bool traverse(const ray& r, interval ray_t, hit_record* rec) const {
+        // Closest hit into *rec, or with any_hit, whether anything is hit at all.
+        if (root == no_root)
+            return false;
+        if (root & leaf_bit)
+            return any_hit ? primitives[root & ~leaf_bit]->occluded(r, ray_t)
+                           : primitives[root & ~leaf_bit]->hit(r, ray_t, *rec);
+
+        const point3 origin = r.origin();
+        const vec3 inv_dir(1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z());
+        bool hit_anything = false;
+
+        struct entry {
+            uint32_t node;
+            double   t_near;
+            double   lo[3], hi[3];
+        };
+        entry stack[max_depth];  // One pending sibling per interior level at most
+        int top = 0;
+        stack[top++] = entry{ root, ray_t.min,
+                              { bbox.x.min, bbox.y.min, bbox.z.min },
+                              { bbox.x.max, bbox.y.max, bbox.z.max } };
+        double t_root;
+        if (!box_hit(stack[0].lo, stack[0].hi, origin, inv_dir, ray_t, t_root))
+            return false;
+
+        while (top > 0) {
+            const entry current = stack[--top];
+            if (current.t_near > ray_t.max)
+                continue;
+            RT_STAT(thread_stats().bvh_nodes_visited++);
+
+            const packed_node& node = nodes[current.node];
+            entry children[2];
+            bool hit_child[2];
+            double scale[3];
+            for (int a = 0; a < 3; a++)
+                scale[a] = (current.hi[a] - current.lo[a]) / 255;
+            for (int c = 0; c < 2; c++) {
+                children[c].node = node.child[c];
+                for (int a = 0; a < 3; a++) {
+                    children[c].lo[a] = decode(current.lo[a], current.hi[a], scale[a], node.lo[c][a]);
+                    children[c].hi[a] = decode(current.lo[a], current.hi[a], scale[a], node.hi[c][a]);
+                }
+                hit_child[c] = box_hit(children[c].lo, children[c].hi, origin, inv_dir, ray_t,
+                                       children[c].t_near);
+            }
+
+            // Leaves are tested straight away; interior children are pushed far one first.
+            for (int c = 0; c < 2; c++)
+                if (hit_child[c] && (children[c].node & leaf_bit)) {
+                    const auto& object = primitives[children[c].node & ~leaf_bit];
+                    if (any_hit) {
+                        if (object->occluded(r, ray_t))
+                            return true;
+                    } else if (object->hit(r, ray_t, *rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec->t;
+                    }
+                    hit_child[c] = false;
+                }
+
+            int near = (hit_child[1] && (!hit_child[0] || children[1].t_near < children[0].t_near)) ? 1 : 0;
+            int far = 1 - near;
+            if (hit_child[far]) stack[top++] = children[far];
+            if (hit_child[near]) stack[top++] = children[near];
+        }
+        return hit_anything;
+    }
+
+    struct file_header {
+        char     magic[8];
+        uint32_t node_count;
+        uint32_t primitive_count;
+        uint32_t root;
+        uint32_t reserved = 0;
+        uint64_t fingerprint;  // Of the primitive list the tree was built over
+        double   bounds[6];    // Root min x,y,z then max x,y,z
+    };
+    static constexpr const char* file_magic = "RTCBVH2";
+
+    std::vector<shared_ptr<hittable>> primitives;
+    std::vector<packed_node> storage;  // Nodes of a tree built in memory
+    const packed_node* nodes = nullptr;
+    uint32_t node_count = 0;
+    uint32_t root = no_root;
+    aabb bbox;
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+
+    explicit compressed_bvh(std::vector<shared_ptr<hittable>>&& objects) : primitives(std::move(objects)) {}
+
+    static std::vector<shared_ptr<hittable>> flatten(const hittable_list& list) {
+        std::vector<shared_ptr<hittable>> objects;
+        list.collect_primitives(objects);
+        return objects;
+    }
+
+    static uint64_t fingerprint(const std::vector<shared_ptr<hittable>>& objects) {
+        // FNV-1a over every primitive's bounding box in order, then over their union (the root
+        // bounds), so a tree only maps back onto the list it was built for.
+        uint64_t h = 14695981039346656037ull;
+        auto add = [&](const aabb& b) {
+            double v[6] = { b.x.min, b.y.min, b.z.min, b.x.max, b.y.max, b.z.max };
+            unsigned char bytes[sizeof(v)];
+            memcpy(bytes, v, sizeof(v));
+            for (unsigned char c : bytes) h = (h ^ c) * 1099511628211ull;
+        };
+        aabb total;
+        for (const auto& object : objects) {
+            auto b = object->bounding_box();
+            add(b);
+            total = aabb(total, b);
+        }
+        add(total);
+        return h;
+    }
+
+    bool valid() const {
+        // Every reference in range and every interior child after its parent (as build() writes
+        // them), so the tree has no cycles; then no path deeper than max_depth interior levels.
+        auto primitive_count = uint32_t(primitives.size());
+        auto in_range = [&](uint32_t ref, uint32_t parent) {
+            return (ref & leaf_bit) ? (ref & ~leaf_bit) < primitive_count
+                                    : ref < node_count && (parent == no_root || ref > parent);
+        };
+        if (node_count == 0)
+            return root == no_root ? primitive_count == 0 : (root & leaf_bit) && in_range(root, no_root);
+        if (!in_range(root, no_root) || (root & leaf_bit))
+            return false;
+
+        std::vector<uint8_t> level(node_count, 0);  // Interior levels down to each node, 0 if unreached
+        level[root] = 1;
+        for (uint32_t i = root; i < node_count; i++) {
+            if (level[i] == 0) continue;
+            for (int c = 0; c < 2; c++) {
+                uint32_t child = nodes[i].child[c];
+                if (!in_range(child, i))
+                    return false;
+                if (child & leaf_bit) continue;
+                if (level[i] >= max_depth)
+                    return false;
+                level[child] = std::max<uint8_t>(level[child], level[i] + 1);
+            }
+        }
+        return true;
+    }
+
+    static double decode(double lo, double hi, double scale, uint8_t q) {
+        // Both end points decode exactly (0 trivially), so a child can always be bounded.
+        double v = lo + q * scale;
+        return q == 255 ? hi : v;
+    }
+
+    static double decode(double lo, double hi, uint8_t q) {
+        return decode(lo, hi, (hi - lo) / 255, q);
+    }
+
+    static uint8_t quantize_down(double lo, double hi, double v) {
+        double scale = hi - lo;
+        int q = scale > 0 ? int(std::floor((v - lo) / scale * 255)) : 0;
+        q = std::clamp(q, 0, 255);
+        while (q > 0 && decode(lo, hi, uint8_t(q)) > v) q--;
+        return uint8_t(q);
+    }
+
+    static uint8_t quantize_up(double lo, double hi, double v) {
+        double scale = hi - lo;
+        int q = scale > 0 ? int(std::ceil((v - lo) / scale * 255)) : 255;
+        q = std::clamp(q, 0, 255);
+        while (q < 255 && decode(lo, hi, uint8_t(q)) < v) q++;
+        return uint8_t(q);
+    }
+
+    static bool box_hit(const double lo[3], const double hi[3], const point3& origin,
+                        const vec3& inv_dir, const interval& ray_t, double& t_near) {
+        double t0 = ray_t.min, t1 = ray_t.max;
+        for (int a = 0; a < 3; a++) {
+            double ta = (lo[a] - origin[a]) * inv_dir[a];
+            double tb = (hi[a] - origin[a]) * inv_dir[a];
+            if (inv_dir[a] < 0) std::swap(ta, tb);
+            t0 = ta > t0 ? ta : t0;
+            t1 = tb < t1 ? tb : t1;
+        }
+        t_near = t0;
+        return t0 <= t1;
+    }
+
+    // Build: a binned SAH tree over the primitives with one primitive per leaf, written out
+    // top-down so every node is quantized against its decoded (not exact) bounds.
+
+    struct build_node {
+        aabb     box[2];
+        uint32_t child[2];
+    };
+
+    void build() {
+        if (primitives.empty())
+            return;
+
+        std::vector<aabb> boxes;
+        std::vector<point3> centroids;
+        for (const auto& object : primitives) {
+            auto b = object->bounding_box();
+            boxes.push_back(b);
+            centroids.push_back(point3((b.x.min + b.x.max) / 2, (b.y.min + b.y.max) / 2, (b.z.min + b.z.max) / 2));
+            bbox = aabb(bbox, b);
+        }
+
+        std::vector<uint32_t> order(primitives.size());
+        for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+
+        std::vector<build_node> tree;
+        aabb root_box;
+        root = build_range(tree, boxes, centroids, order, 0, uint32_t(order.size()), 0, root_box);
+
+        storage.resize(tree.size());
+        node_count = uint32_t(tree.size());
+        if (!(root & leaf_bit))
+            encode(tree, root, bbox.x.min, bbox.y.min, bbox.z.min, bbox.x.max, bbox.y.max, bbox.z.max);
+    }
+
+    uint32_t build_range(std::vector<build_node>& tree, const std::vector<aabb>& boxes,
+                         const std::vector<point3>& centroids, std::vector<uint32_t>& order,
+                         uint32_t start, uint32_t end, int depth, aabb& range_box) {
+        // depth counts the interior levels above this node. A median split needs ceil(log2(n))
+        // more below it, so the SAH split is only taken while the larger side still fits.
+        range_box = aabb();
+        for (uint32_t i = start; i < end; i++)
+            range_box = aabb(range_box, boxes[order[i]]);
+        if (end - start == 1)
+            return leaf_bit | order[start];
+
+        aabb centroid_box;
+        for (uint32_t i = start; i < end; i++)
+            centroid_box = aabb(centroid_box, aabb(centroids[order[i]], centroids[order[i]]));
+
+        const int bins = 16;
+        int best_axis = -1, best_split = 0;
+        double best_cost = infinity;
+        auto area = [](const aabb& b) {
+            double dx = b.x.size(), dy = b.y.size(), dz = b.z.size();
+            return dx*dy + dy*dz + dz*dx;
+        };
+        auto bin_of = [&](uint32_t prim, int axis) {
+            const auto& range = centroid_box.axis(axis);
+            int b = int(bins * (centroids[prim][axis] - range.min) / range.size());
+            return std::clamp(b, 0, bins - 1);
+        };
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (centroid_box.axis(axis).size() <= 0) continue;
+            aabb bin_box[bins];
+            int bin_count[bins] = {};
+            for (uint32_t i = start; i < end; i++) {
+                int b = bin_of(order[i], axis);
+                bin_box[b] = aabb(bin_box[b], boxes[order[i]]);
+                bin_count[b]++;
+            }
+
+            // Sweep from the right, then evaluate each split from the left.
+            aabb right_box[bins];
+            int right_count[bins];
+            aabb accum;
+            int count = 0;
+            for (int b = bins - 1; b > 0; b--) {
+                accum = aabb(accum, bin_box[b]);
+                count += bin_count[b];
+                right_box[b] = accum;
+                right_count[b] = count;
+            }
+            accum = aabb();
+            count = 0;
+            for (int split = 1; split < bins; split++) {
+                accum = aabb(accum, bin_box[split - 1]);
+                count += bin_count[split - 1];
+                if (count == 0 || right_count[split] == 0) continue;
+                double cost = count * area(accum) + right_count[split] * area(right_box[split]);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = split;
+                }
+            }
+        }
+
+        uint32_t mid = start + (end - start) / 2;
+        bool sah = false;
+        if (best_axis >= 0) {
+            uint32_t split = uint32_t(std::partition(order.begin() + start, order.begin() + end,
+                [&](uint32_t prim) { return bin_of(prim, best_axis) < best_split; }) - order.begin());
+            if (depth + 1 + levels_for(std::max(split - start, end - split)) <= max_depth) {
+                mid = split;
+                sah = true;
+            }
+        }
+        if (!sah) {
+            int axis = centroid_box.longest_axis();
+            std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+        }
+
+        uint32_t index = uint32_t(tree.size());
+        tree.push_back(build_node());
+        aabb left_box, right_box;
+        uint32_t left = build_range(tree, boxes, centroids, order, start, mid, depth + 1, left_box);
+        uint32_t right = build_range(tree, boxes, centroids, order, mid, end, depth + 1, right_box);
+        tree[index] = build_node{ { left_box, right_box }, { left, right } };
+        return index;
+    }
+
+    static int levels_for(uint32_t count) {
+        // Interior levels of a median-split tree over count primitives: ceil(log2(count)).
+        int levels = 0;
+        while ((uint64_t(1) << levels) < count) levels++;
+        return levels;
+    }
+
+    void encode(const std::vector<build_node>& tree, uint32_t index,
+                double x0, double y0, double z0, double x1, double y1, double z1) {
+        const double lo[3] = { x0, y0, z0 }, hi[3] = { x1, y1, z1 };
+        const auto& src = tree[index];
+        auto& dst = storage[index];
+
+        for (int c = 0; c < 2; c++) {
+            dst.child[c] = src.child[c];
+            for (int a = 0; a < 3; a++) {
+                dst.lo[c][a] = quantize_down(lo[a], hi[a], src.box[c].axis(a).min);
+                dst.hi[c][a] = quantize_up(lo[a], hi[a], src.box[c].axis(a).max);
+            }
+            if (!(src.child[c] & leaf_bit))
+                encode(tree, src.child[c],
+                       decode(lo[0], hi[0], dst.lo[c][0]), decode(lo[1], hi[1], dst.lo[c][1]),
+                       decode(lo[2], hi[2], dst.lo[c][2]), decode(lo[0], hi[0], dst.hi[c][0]),
+                       decode(lo[1], hi[1], dst.hi[c][1]), decode(lo[2], hi[2], dst.hi[c][2]));
+        }
+    }
+};
+
+#endif
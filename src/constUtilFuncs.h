@@ -2,6 +2,7 @@
 #define CONSTUTILFUNCS_H
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <random>
@@ -24,10 +25,26 @@ inline double degrees_to_radians(double degrees) {
 }
 
 
+inline std::mt19937& random_generator() {
+    // Each thread draws from its own generator, so parallel renders neither race on the
+    // generator state nor depend on how work happens to be scheduled across threads.
+    thread_local std::mt19937 generator;
+    return generator;
+}
+
+inline void seed_random(uint64_t seed) {
+    // Reseeds the calling thread's generator. The seed is mixed first (splitmix64) so that
+    // consecutive seeds, e.g. neighbouring pixel indices, give unrelated sequences.
+    seed += 0x9e3779b97f4a7c15ull;
+    seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+    seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+    seed ^= seed >> 31;
+    random_generator().seed(static_cast<std::mt19937::result_type>(seed ^ (seed >> 32)));
+}
+
 inline double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return distribution(random_generator());
 }
 
 inline double random_double(double min, double max) {
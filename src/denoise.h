@@ -0,0 +1,176 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "constUtilFuncs.h"
+
+#include "color.h"
+
+#include <algorithm>
+#include <execution>
+#include <numeric>
+#include <vector>
+
+// Edge-avoiding a-trous wavelet denoiser (Dammertz et al. 2010).
+//
+// Each pass is a 5x5 B3-spline blur whose taps are spread 2^pass pixels apart, with every tap
+// down-weighted when it differs from the center pixel in color, albedo, normal or depth. Color
+// is filtered as illumination (color divided by first-hit albedo) and multiplied back at the
+// end, so texture detail that the albedo buffer already knows about is not blurred away. As in
+// SVGF, color differences are measured against the pixel's estimated noise (the variance of its
+// sample mean, itself filtered along with the color), so noisy regions are smoothed harder than
+// converged ones.
+//
+// Buffers are stored as separate float planes and every pass walks the taps in the outer loop
+// and the pixels of a row in the inner loop, so the inner loop is branch-free and contiguous
+// and the compiler can vectorize it. Rows are filtered in parallel.
+
+struct denoise_buffers {
+    int width = 0;
+    int height = 0;
+    std::vector<color>  beauty;  // Per-pixel mean radiance
+    std::vector<color>  albedo;  // Mean first-hit albedo
+    std::vector<vec3>   normal;  // Mean first-hit shading normal
+    std::vector<double> depth;   // Mean first-hit distance (0 where the camera ray escaped)
+    std::vector<double> variance; // Variance of the pixel's mean luminance
+};
+
+struct denoise_settings {
+    int    iterations   = 5;    // Number of a-trous passes (filter radius 2^(iterations+1))
+    double sigma_color  = 4.0;  // Illumination edge stopping, in standard deviations
+    double sigma_albedo = 0.1;
+    double sigma_normal = 0.3;
+    double sigma_depth  = 0.2;  // Relative to the center pixel's depth
+};
+
+namespace denoise_detail {
+
+inline float fast_exp_neg(float x) {
+    // exp(x) for x <= 0 as (1 + x/256)^256; about 1% relative error in the range that matters for
+    // filter weights, and plain arithmetic so it vectorizes.
+    x = 1.0f + std::max(x, -256.0f) / 256.0f;
+    x *= x; x *= x; x *= x; x *= x;
+    x *= x; x *= x; x *= x; x *= x;
+    return x;
+}
+
+struct planes {
+    std::vector<float> r, g, b;
+    explicit planes(size_t n = 0) : r(n), g(n), b(n) {}
+};
+
+} // namespace denoise_detail
+
+inline std::vector<color> denoise_atrous(const denoise_buffers& in, const denoise_settings& s = {}) {
+    using namespace denoise_detail;
+    const int w = in.width, h = in.height;
+    const size_t n = size_t(w) * h;
+    const float eps = 1e-3f;
+
+    // Split into float planes, demodulating color by albedo.
+    planes illum(n), albedo(n), normal(n);
+    std::vector<float> depth(n), variance(n), next_variance(n);
+    for (size_t k = 0; k < n; k++) {
+        albedo.r[k] = float(in.albedo[k].x());
+        albedo.g[k] = float(in.albedo[k].y());
+        albedo.b[k] = float(in.albedo[k].z());
+        illum.r[k] = float(in.beauty[k].x()) / (albedo.r[k] + eps);
+        illum.g[k] = float(in.beauty[k].y()) / (albedo.g[k] + eps);
+        illum.b[k] = float(in.beauty[k].z()) / (albedo.b[k] + eps);
+        normal.r[k] = float(in.normal[k].x());
+        normal.g[k] = float(in.normal[k].y());
+        normal.b[k] = float(in.normal[k].z());
+        depth[k] = float(in.depth[k]);
+
+        float albedo_lum = (albedo.r[k] + albedo.g[k] + albedo.b[k]) / 3.0f + eps;
+        variance[k] = float(in.variance[k]) / (albedo_lum * albedo_lum);
+    }
+
+    static const float kernel[5] = { 1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16 };
+    const float inv_albedo = 1.0f / float(s.sigma_albedo * s.sigma_albedo);
+    const float inv_normal = 1.0f / float(s.sigma_normal * s.sigma_normal);
+    const float inv_depth  = 1.0f / float(s.sigma_depth * s.sigma_depth);
+
+    std::vector<int> rows(h);
+    std::iota(rows.begin(), rows.end(), 0);
+    planes next(n);
+
+    for (int pass = 0; pass < s.iterations; pass++) {
+        const int step = 1 << pass;
+        const float sigma_c2 = float(s.sigma_color * s.sigma_color);
+
+        std::for_each(std::execution::par, rows.begin(), rows.end(), [&](int y) {
+            std::vector<float> sum_r(w, 0.0f), sum_g(w, 0.0f), sum_b(w, 0.0f), sum_w(w, 0.0f);
+            std::vector<float> sum_var(w, 0.0f), inv_color(w);
+            std::vector<int> tap_x(w);
+            const size_t row = size_t(y) * w;
+
+            // The noise estimate itself comes from few samples, so it is blurred over 3x3
+            // pixels first; otherwise pixels whose samples happened to agree reject everything.
+            for (int x = 0; x < w; x++) {
+                float var = 0.0f;
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++) {
+                        const int vy = std::clamp(y + dy, 0, h - 1);
+                        const int vx = std::clamp(x + dx, 0, w - 1);
+                        var += kernel[2+dx] * kernel[2+dy] * variance[size_t(vy) * w + vx];
+                    }
+                inv_color[x] = 1.0f / (sigma_c2 * var / 0.765625f + 1e-4f);
+            }
+
+            for (int dy = -2; dy <= 2; dy++) {
+                const int ty = std::clamp(y + dy*step, 0, h - 1);
+                const size_t trow = size_t(ty) * w;
+
+                for (int dx = -2; dx <= 2; dx++) {
+                    const float k = kernel[dx+2] * kernel[dy+2];
+                    for (int x = 0; x < w; x++)
+                        tap_x[x] = std::clamp(x + dx*step, 0, w - 1);
+
+                    for (int x = 0; x < w; x++) {
+                        const size_t p = row + x, q = trow + tap_x[x];
+
+                        float dc = (illum.r[p]-illum.r[q])*(illum.r[p]-illum.r[q])
+                                 + (illum.g[p]-illum.g[q])*(illum.g[p]-illum.g[q])
+                                 + (illum.b[p]-illum.b[q])*(illum.b[p]-illum.b[q]);
+                        float da = (albedo.r[p]-albedo.r[q])*(albedo.r[p]-albedo.r[q])
+                                 + (albedo.g[p]-albedo.g[q])*(albedo.g[p]-albedo.g[q])
+                                 + (albedo.b[p]-albedo.b[q])*(albedo.b[p]-albedo.b[q]);
+                        float dn = (normal.r[p]-normal.r[q])*(normal.r[p]-normal.r[q])
+                                 + (normal.g[p]-normal.g[q])*(normal.g[p]-normal.g[q])
+                                 + (normal.b[p]-normal.b[q])*(normal.b[p]-normal.b[q]);
+                        float dz = (depth[p]-depth[q]) / (depth[p] + eps);
+
+                        float weight = k * fast_exp_neg(-dc*inv_color[x] - da*inv_albedo
+                                                        - dn*inv_normal - dz*dz*inv_depth);
+                        sum_r[x] += weight * illum.r[q];
+                        sum_g[x] += weight * illum.g[q];
+                        sum_b[x] += weight * illum.b[q];
+                        sum_w[x] += weight;
+                        sum_var[x] += weight * weight * variance[q];
+                    }
+                }
+            }
+
+            for (int x = 0; x < w; x++) {
+                // The center tap always has weight k(0,0) > 0, so sum_w never vanishes.
+                next.r[row + x] = sum_r[x] / sum_w[x];
+                next.g[row + x] = sum_g[x] / sum_w[x];
+                next.b[row + x] = sum_b[x] / sum_w[x];
+                next_variance[row + x] = sum_var[x] / (sum_w[x] * sum_w[x]);
+            }
+        });
+
+        std::swap(illum, next);
+        std::swap(variance, next_variance);
+    }
+
+    // Remodulate by albedo.
+    std::vector<color> out(n);
+    for (size_t k = 0; k < n; k++)
+        out[k] = color(illum.r[k] * (albedo.r[k] + eps),
+                       illum.g[k] * (albedo.g[k] + eps),
+                       illum.b[k] * (albedo.b[k] + eps));
+    return out;
+}
+
+#endif
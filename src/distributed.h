@@ -0,0 +1,468 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "constUtilFuncs.h"
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "scenes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <csignal>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Coordinator/worker tile rendering across processes (Linux).
+//
+// The coordinator starts `workers` copies of this executable with `--worker <index>` and talks
+// to each one over a pair of pipes. It first sends the scene description (scene number and size
+// plus every camera setting that affects pixels, path guiding and caustics included), then hands
+// out image tiles one at a time. Workers build the scene themselves from the same seed, and train
+// their own guide or trace their own photon map once, so every worker produces exactly the pixels
+// a local render would, and the coordinator just copies finished tiles into place. Tiles use a
+// single photon map, so progressive caustics (caustic_passes > 1) are for local renders only.
+//
+// Protocol, one message per line, coordinator -> worker:
+//     scene <scene> <size> <camera settings...>
+//     tile <id> <x0> <y0> <x1> <y1>
+//     quit
+// worker -> coordinator:
+//     ready
+//     done <id> <pixel count> <rays>\n followed by <pixel count> raw colors (3 doubles each)
+//
+// A worker that exits or closes its pipe has its tile put back in the queue. Once the queue is
+// empty, tiles that have been in flight for much longer than the average tile are handed to an
+// idle worker as well and whichever copy finishes first wins. If every worker dies the
+// coordinator renders the remaining tiles itself.
+//
+// For testing, worker 0 honours two environment variables: RT_WORKER_CRASH_AFTER=<n> makes it
+// exit after n tiles, and RT_WORKER_SLOW_MS=<ms> makes it sleep that long before every tile.
+
+namespace distributed_detail {
+
+inline bool write_all(int fd, const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        auto n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool write_line(int fd, const std::string& line) {
+    return write_all(fd, line.data(), line.size());
+}
+
+} // namespace distributed_detail
+
+inline std::string camera_description(const camera& cam) {
+    std::ostringstream out;
+    out.precision(17);
+    out << cam.aspect_ratio << ' ' << cam.image_width << ' ' << cam.samples_per_pixel << ' '
+        << cam.max_depth << ' ' << cam.background << ' ' << cam.vfov << ' '
+        << cam.lookfrom << ' ' << cam.lookat << ' ' << cam.vup << ' '
+        << cam.defocus_angle << ' ' << cam.focus_dist << ' ' << cam.seed << ' '
+        << static_cast<int>(cam.sampling) << ' ' << cam.sample_lights << ' '
+        << cam.path_guiding << ' ' << cam.guiding_passes << ' '
+        << cam.caustic_photons << ' ' << cam.caustic_radius;
+    return out.str();
+}
+
+inline bool read_camera_description(std::istream& in, camera& cam) {
+    auto read_vec = [&in](vec3& v) { return bool(in >> v[0] >> v[1] >> v[2]); };
+    int sampling = 0;
+    bool ok = (in >> cam.aspect_ratio >> cam.image_width >> cam.samples_per_pixel >> cam.max_depth)
+        && read_vec(cam.background) && (in >> cam.vfov)
+        && read_vec(cam.lookfrom) && read_vec(cam.lookat) && read_vec(cam.vup)
+        && (in >> cam.defocus_angle >> cam.focus_dist >> cam.seed >> sampling >> cam.sample_lights)
+        && (in >> cam.path_guiding >> cam.guiding_passes)
+        && (in >> cam.caustic_photons >> cam.caustic_radius);
+    cam.sampling = static_cast<sampler_type>(sampling);
+    return ok;
+}
+
+inline int run_render_worker(int worker_index) {
+    // Worker side: serve tile requests on stdin until told to quit or stdin closes.
+    using namespace distributed_detail;
+
+    int crash_after = -1, slow_ms = 0;
+    if (worker_index == 0) {
+        if (auto env = getenv("RT_WORKER_CRASH_AFTER")) crash_after = atoi(env);
+        if (auto env = getenv("RT_WORKER_SLOW_MS")) slow_ms = atoi(env);
+    }
+
+    hittable_list world;
+    camera cam;
+    cam.show_progress = false;
+    int tiles_done = 0;
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::istringstream msg(line);
+        std::string command;
+        msg >> command;
+
+        if (command == "scene") {
+            int scene;
+            size_t size;
+            if (!(msg >> scene >> size) || !read_camera_description(msg, cam)) {
+                std::cerr << "worker " << worker_index << ": bad scene description\n";
+                return 1;
+            }
+            seed_random(cam.seed);
+            world = build_scene(scene, size);
+            if (!write_line(STDOUT_FILENO, "ready\n")) return 1;
+        } else if (command == "tile") {
+            int id, x0, y0, x1, y1;
+            if (!(msg >> id >> x0 >> y0 >> x1 >> y1)) return 1;
+            if (crash_after >= 0 && tiles_done >= crash_after) _exit(3);
+            if (slow_ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(slow_ms));
+
+            std::vector<color> pixels;
+            uint64_t rays;
+            cam.render_tile(world, x0, y0, x1, y1, pixels, rays);
+            tiles_done++;
+
+            std::ostringstream header;
+            header << "done " << id << ' ' << pixels.size() << ' ' << rays << '\n';
+            if (!write_line(STDOUT_FILENO, header.str())
+                || !write_all(STDOUT_FILENO, pixels.data(), pixels.size() * sizeof(color)))
+                return 1;
+        } else if (command == "quit") {
+            break;
+        }
+    }
+    return 0;
+}
+
+class render_coordinator {
+public:
+    int    tile_size   = 32;    // Tile edge length in pixels
+    double slow_factor = 4.0;   // In-flight tiles this many times slower than average get duplicated
+    bool   show_progress = true;
+
+    render_coordinator(int _scene, const camera& _cam, int _workers, size_t _scene_size = 0)
+      : scene(_scene), scene_size(_scene_size), cam(_cam), worker_count(_workers) {}
+
+    void render(std::ostream& out) {
+        std::vector<color> image;
+        render(image);
+        cam.write_image(out, image);
+    }
+
+    void render(std::vector<color>& image) {
+        // Renders the full image as per-pixel sample sums, row-major.
+        using namespace distributed_detail;
+        signal(SIGPIPE, SIG_IGN); // Writes to dead workers must fail, not kill us
+
+        width = cam.image_width;
+        height = cam.height();
+        image.assign(width * height, color(0,0,0));
+        make_tiles();
+        start_workers();
+
+        auto start = clock::now();
+        size_t tiles_done = 0, reported = 0;
+        double total_tile_ms = 0;
+        rays_traced = 0;
+
+        while (tiles_done < tiles.size()) {
+            if (alive_workers() == 0) {
+                std::cerr << "\nAll render workers failed; finishing the image locally.\n";
+                render_remaining_locally(image, tiles_done);
+                break;
+            }
+            assign_tiles(tiles_done > 0 ? total_tile_ms / tiles_done : 0.0);
+
+            std::vector<pollfd> fds;
+            std::vector<int> which;
+            for (size_t w = 0; w < workers.size(); w++)
+                if (workers[w].alive) {
+                    fds.push_back({ workers[w].from_fd, POLLIN, 0 });
+                    which.push_back(static_cast<int>(w));
+                }
+            if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) break;
+
+            for (size_t k = 0; k < fds.size(); k++) {
+                if (!(fds[k].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                auto& wk = workers[which[k]];
+
+                char buffer[1 << 16];
+                auto n = read(wk.from_fd, buffer, sizeof(buffer));
+                if (n <= 0) {
+                    retire(wk, "exited");
+                    continue;
+                }
+                wk.inbox.append(buffer, n);
+
+                int tile_id;
+                std::vector<color> pixels;
+                uint64_t rays;
+                while (parse_message(wk, tile_id, pixels, rays)) {
+                    if (tile_id < 0) continue; // "ready"
+                    auto& t = tiles[tile_id];
+                    t.in_flight--;
+                    wk.tile = -1;
+                    if (t.done) continue; // A duplicate finished second
+
+                    std::chrono::duration<double, std::milli> elapsed = clock::now() - wk.started;
+                    total_tile_ms += elapsed.count();
+                    copy_tile(t, pixels, image);
+                    t.done = true;
+                    tiles_done++;
+                    rays_traced += rays;
+                }
+            }
+
+            if (show_progress && tiles_done != reported) {
+                reported = tiles_done;
+                std::clog << "\rTiles: " << tiles_done << '/' << tiles.size()
+                          << "  workers alive: " << alive_workers() << "   " << std::flush;
+            }
+        }
+
+        stop_workers();
+        std::chrono::duration<double, std::milli> elapsed = clock::now() - start;
+        if (show_progress)
+            std::clog << "\rDone: " << tiles.size() << " tiles in " << elapsed.count() << " ms on "
+                      << workers.size() << " workers.\n";
+    }
+
+    uint64_t last_rays_traced() const { return rays_traced; }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct tile {
+        int x0, y0, x1, y1;
+        bool done = false;
+        int in_flight = 0;  // Workers currently rendering it
+    };
+
+    struct worker {
+        pid_t pid = -1;
+        int to_fd = -1, from_fd = -1;
+        bool alive = false, ready = false;
+        int tile = -1;
+        clock::time_point started;
+        std::string inbox;
+    };
+
+    int scene;
+    size_t scene_size;
+    camera cam;
+    int worker_count;
+    int width = 0, height = 0;
+    uint64_t rays_traced = 0;
+    std::vector<tile> tiles;
+    std::deque<int> pending;
+    std::vector<worker> workers;
+
+    void make_tiles() {
+        tiles.clear();
+        pending.clear();
+        for (int y = 0; y < height; y += tile_size)
+            for (int x = 0; x < width; x += tile_size) {
+                tile t;
+                t.x0 = x;
+                t.y0 = y;
+                t.x1 = std::min(x + tile_size, width);
+                t.y1 = std::min(y + tile_size, height);
+                pending.push_back(static_cast<int>(tiles.size()));
+                tiles.push_back(t);
+            }
+    }
+
+    void start_workers() {
+        using namespace distributed_detail;
+        workers.assign(worker_count, worker());
+        auto description = "scene " + std::to_string(scene) + " " + std::to_string(scene_size) + " "
+                         + camera_description(cam) + "\n";
+
+        for (int w = 0; w < worker_count; w++) {
+            int to_child[2], from_child[2];
+            if (pipe(to_child) != 0 || pipe(from_child) != 0) {
+                std::cerr << "ERROR: Could not create pipes for render worker " << w << ".\n";
+                continue;
+            }
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                dup2(to_child[0], STDIN_FILENO);
+                dup2(from_child[1], STDOUT_FILENO);
+                for (int fd : { to_child[0], to_child[1], from_child[0], from_child[1] })
+                    close(fd);
+                auto index = std::to_string(w);
+                execl("/proc/self/exe", "ray_tracing", "--worker", index.c_str(),
+                      static_cast<char*>(nullptr));
+                _exit(127);
+            }
+            close(to_child[0]);
+            close(from_child[1]);
+            if (pid < 0) {
+                close(to_child[1]);
+                close(from_child[0]);
+                std::cerr << "ERROR: Could not start render worker " << w << ".\n";
+                continue;
+            }
+
+            auto& wk = workers[w];
+            wk.pid = pid;
+            wk.to_fd = to_child[1];
+            wk.from_fd = from_child[0];
+            wk.alive = write_line(wk.to_fd, description);
+        }
+    }
+
+    int alive_workers() const {
+        int n = 0;
+        for (const auto& w : workers) n += w.alive;
+        return n;
+    }
+
+    void assign_tiles(double mean_tile_ms) {
+        using namespace distributed_detail;
+        auto now = clock::now();
+
+        for (auto& wk : workers) {
+            if (!wk.alive || !wk.ready || wk.tile >= 0) continue;
+
+            int id = -1;
+            while (!pending.empty() && id < 0) {
+                id = pending.front();
+                pending.pop_front();
+                if (tiles[id].done) id = -1;
+            }
+
+            if (id < 0 && mean_tile_ms > 0) {
+                // Nothing queued: back up the slowest straggler that nobody else is duplicating.
+                double worst = slow_factor * mean_tile_ms;
+                for (const auto& other : workers) {
+                    if (!other.alive || other.tile < 0 || tiles[other.tile].in_flight > 1) continue;
+                    std::chrono::duration<double, std::milli> elapsed = now - other.started;
+                    if (elapsed.count() > worst) {
+                        worst = elapsed.count();
+                        id = other.tile;
+                    }
+                }
+            }
+            if (id < 0) continue;
+
+            const auto& t = tiles[id];
+            std::ostringstream msg;
+            msg << "tile " << id << ' ' << t.x0 << ' ' << t.y0 << ' ' << t.x1 << ' ' << t.y1 << '\n';
+            if (!write_line(wk.to_fd, msg.str())) {
+                if (!tiles[id].done) pending.push_front(id);
+                retire(wk, "stopped accepting work");
+                continue;
+            }
+            wk.tile = id;
+            wk.started = now;
+            tiles[id].in_flight++;
+        }
+    }
+
+    bool parse_message(worker& wk, int& tile_id, std::vector<color>& pixels, uint64_t& rays) {
+        // Pops one complete message off the worker's inbox. Returns false if none is complete yet.
+        auto eol = wk.inbox.find('\n');
+        if (eol == std::string::npos) return false;
+
+        std::istringstream header(wk.inbox.substr(0, eol));
+        std::string command;
+        header >> command;
+
+        if (command == "ready") {
+            wk.ready = true;
+            wk.inbox.erase(0, eol + 1);
+            tile_id = -1;
+            return true;
+        }
+
+        size_t count;
+        if (command != "done" || !(header >> tile_id >> count >> rays)
+            || tile_id < 0 || tile_id >= static_cast<int>(tiles.size())) {
+            retire(wk, "sent a malformed message");
+            return false;
+        }
+
+        auto payload = count * sizeof(color);
+        if (wk.inbox.size() < eol + 1 + payload) return false;
+
+        pixels.resize(count);
+        std::memcpy(static_cast<void*>(pixels.data()), wk.inbox.data() + eol + 1, payload);
+        wk.inbox.erase(0, eol + 1 + payload);
+        return true;
+    }
+
+    void copy_tile(const tile& t, const std::vector<color>& pixels, std::vector<color>& image) const {
+        int tile_width = t.x1 - t.x0;
+        for (int j = t.y0; j < t.y1; j++)
+            std::copy_n(pixels.begin() + (j - t.y0) * tile_width, tile_width,
+                        image.begin() + j * width + t.x0);
+    }
+
+    void retire(worker& wk, const char* reason) {
+        // Stops using a worker and requeues its tile.
+        if (!wk.alive) return;
+        std::cerr << "\nRender worker " << wk.pid << ' ' << reason << "; reassigning its work.\n";
+        wk.alive = false;
+        if (wk.tile >= 0) {
+            auto& t = tiles[wk.tile];
+            t.in_flight--;
+            if (!t.done && t.in_flight == 0) pending.push_front(wk.tile);
+            wk.tile = -1;
+        }
+        close(wk.to_fd);
+        close(wk.from_fd);
+        kill(wk.pid, SIGKILL);
+        waitpid(wk.pid, nullptr, 0);
+    }
+
+    void stop_workers() {
+        using namespace distributed_detail;
+        for (auto& wk : workers) {
+            if (!wk.alive) continue;
+            write_line(wk.to_fd, "quit\n");
+            close(wk.to_fd);
+            close(wk.from_fd);
+            if (wk.tile >= 0) kill(wk.pid, SIGKILL); // Still busy with a duplicate that lost
+            waitpid(wk.pid, nullptr, 0);
+            wk.alive = false;
+        }
+    }
+
+    void render_remaining_locally(std::vector<color>& image, size_t& tiles_done) {
+        seed_random(cam.seed);
+        hittable_list world = build_scene(scene, scene_size);
+        auto local_cam = cam;
+        local_cam.show_progress = false;
+
+        for (auto& t : tiles) {
+            if (t.done) continue;
+            std::vector<color> pixels;
+            uint64_t rays;
+            local_cam.render_tile(world, t.x0, t.y0, t.x1, t.y1, pixels, rays);
+            copy_tile(t, pixels, image);
+            t.done = true;
+            tiles_done++;
+            rays_traced += rays;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef EXECUTION_CONTEXT_H
+#define EXECUTION_CONTEXT_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <tbb/info.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+// Explicit execution context for a render job.
+//
+// By default everything runs in TBB's global arena on every core. A job that shares the machine
+// can instead run in its own task_arena: limited to a thread count, constrained to one NUMA
+// node (TBB binds the arena's threads to the node's cores through tbbbind/hwloc), and optionally
+// with every thread pinned to a single core while it works for the arena. The parallel STL
+// algorithms in camera run on TBB, so they stay inside whatever arena calls them.
+//
+// Memory follows the threads through first touch: Linux places a page on the node of the thread
+// that first writes it, so framebuffers are allocated by the workers that render into them
+// (render_buffered allocates each row in the task that renders it; incremental_renderer keeps
+// its tiles in a first_touch_buffer).
+
+struct execution_settings {
+    int  threads = 0;          // Threads in the job, the calling thread included (0: all available)
+    int  numa_node = -1;       // NUMA node to run on (-1: any)
+    bool pin_threads = false;  // Pin each thread to one core while it works for the job
+
+    bool is_default() const { return threads <= 0 && numa_node < 0 && !pin_threads; }
+};
+
+namespace execution_detail {
+
+inline std::vector<int> parse_cpu_list(const std::string& text) {
+    // Linux cpulist format: "0-3,8,10-11".
+    std::vector<int> cpus;
+    std::istringstream in(text);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        if (range.empty() || range == "\n") continue;
+        auto dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+inline std::vector<int> usable_cpus(int numa_node) {
+    // CPUs this process may run on, narrowed to one NUMA node's if one is given.
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return cpus;
+
+    std::vector<int> node_cpus;
+    if (numa_node >= 0) {
+        std::ifstream list("/sys/devices/system/node/node" + std::to_string(numa_node) + "/cpulist");
+        std::string text;
+        if (std::getline(list, text))
+            node_cpus = parse_cpu_list(text);
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (numa_node >= 0 && std::find(node_cpus.begin(), node_cpus.end(), cpu) == node_cpus.end())
+            continue;
+        cpus.push_back(cpu);
+    }
+#endif
+    return cpus;
+}
+
+class core_pinning_observer : public tbb::task_scheduler_observer {
+public:
+    // Pins the thread in arena slot k to cpus[k % cpus.size()] while it is in the arena, and
+    // gives it back its old affinity when it leaves (TBB workers move between arenas).
+    core_pinning_observer(tbb::task_arena& arena, std::vector<int> _cpus)
+      : tbb::task_scheduler_observer(arena), cpus(std::move(_cpus)) {
+        observe(true);
+    }
+
+    ~core_pinning_observer() { observe(false); }
+
+    void on_scheduler_entry(bool) override {
+#ifdef __linux__
+        int slot = tbb::this_task_arena::current_thread_index();
+        if (cpus.empty() || slot < 0) return;
+        auto& saved = saved_affinity();
+        saved.valid = pthread_getaffinity_np(pthread_self(), sizeof(saved.mask), &saved.mask) == 0;
+
+        cpu_set_t core;
+        CPU_ZERO(&core);
+        CPU_SET(cpus[slot % cpus.size()], &core);
+        pthread_setaffinity_np(pthread_self(), sizeof(core), &core);
+#endif
+    }
+
+    void on_scheduler_exit(bool) override {
+#ifdef __linux__
+        auto& saved = saved_affinity();
+        if (saved.valid)
+            pthread_setaffinity_np(pthread_self(), sizeof(saved.mask), &saved.mask);
+        saved.valid = false;
+#endif
+    }
+
+private:
+    std::vector<int> cpus;
+
+#ifdef __linux__
+    struct affinity {
+        cpu_set_t mask;
+        bool valid = false;
+    };
+
+    static affinity& saved_affinity() {
+        thread_local affinity saved;
+        return saved;
+    }
+#endif
+};
+
+} // namespace execution_detail
+
+inline bool numa_node_exists(int node) {
+    // Whether TBB knows the node (needs tbbbind; without it TBB reports a single node -1).
+    for (auto id : tbb::info::numa_nodes())
+        if (id == node) return true;
+    return false;
+}
+
+class execution_context {
+public:
+    explicit execution_context(const execution_settings& settings)
+      : arena(constraints(settings))
+    {
+        if (settings.pin_threads)
+            pinning = std::make_unique<execution_detail::core_pinning_observer>(
+                arena, execution_detail::usable_cpus(settings.numa_node));
+    }
+
+    ~execution_context() { pinning.reset(); }  // Stop observing before the arena goes
+
+    template <typename F>
+    auto execute(F&& f) -> decltype(f()) {
+        return arena.execute(std::forward<F>(f));
+    }
+
+    int concurrency() { return arena.max_concurrency(); }
+
+private:
+    tbb::task_arena arena;
+    std::unique_ptr<execution_detail::core_pinning_observer> pinning;
+
+    static tbb::task_arena::constraints constraints(const execution_settings& settings) {
+        tbb::task_arena::constraints c;
+        if (settings.numa_node >= 0 && numa_node_exists(settings.numa_node))
+            c.numa_id = settings.numa_node;
+        if (settings.threads > 0)
+            c.max_concurrency = settings.threads;
+        return c;
+    }
+};
+
+template <typename F>
+auto run_in_context(const execution_settings& settings, F&& f) -> decltype(f()) {
+    // Runs f in an arena set up from settings, or directly when they are the defaults.
+    if (settings.is_default())
+        return f();
+    execution_context context(settings);
+    return context.execute(std::forward<F>(f));
+}
+
+template <typename T>
+class first_touch_buffer {
+    // Zeroed storage for n trivially copyable T. On Linux it is mapped straight from the kernel,
+    // so no page exists until something writes to it and each lands on the NUMA node of the
+    // thread that renders into it first.
+    static_assert(std::is_trivially_copyable<T>::value, "first_touch_buffer holds plain data");
+
+public:
+    first_touch_buffer() = default;
+    explicit first_touch_buffer(size_t n) : count(n), bytes(std::max<size_t>(n * sizeof(T), 1)) {
+#ifdef __linux__
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        elements = p == MAP_FAILED ? nullptr : static_cast<T*>(p);
+#else
+        elements = static_cast<T*>(std::calloc(n, sizeof(T)));
+#endif
+        if (!elements)
+            throw std::bad_alloc();
+    }
+
+    first_touch_buffer(first_touch_buffer&& other) noexcept { swap(other); }
+    first_touch_buffer& operator=(first_touch_buffer&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+    first_touch_buffer(const first_touch_buffer&) = delete;
+    first_touch_buffer& operator=(const first_touch_buffer&) = delete;
+
+    ~first_touch_buffer() {
+        if (!elements) return;
+#ifdef __linux__
+        munmap(elements, bytes);
+#else
+        std::free(elements);
+#endif
+    }
+
+    T& operator[](size_t k) { return elements[k]; }
+    const T& operator[](size_t k) const { return elements[k]; }
+    T* data() { return elements; }
+    const T* data() const { return elements; }
+    size_t size() const { return count; }
+
+private:
+    T* elements = nullptr;
+    size_t count = 0;
+    size_t bytes = 0;
+
+    void swap(first_touch_buffer& other) noexcept {
+        std::swap(elements, other.elements);
+        std::swap(count, other.count);
+        std::swap(bytes, other.bytes);
+    }
+};
+
+#endif
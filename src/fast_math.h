@@ -0,0 +1,145 @@
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include "constUtilFuncs.h"
+
+#include <cmath>
+
+// Bounded-error replacements for the libm calls in shading hot spots.
+//
+// RT_FAST_MATH picks the build's accuracy mode:
+//     0  libm (default; images match earlier builds exactly)
+//     1  accurate: within ~2e-8 of libm (acos; sin and atan2 are under 1e-10), far below
+//        anything 8-bit output can show
+//     2  fast: shorter polynomials within ~1e-4, still under half a step of 8-bit output
+// fast_sin, fast_acos, fast_atan2 and fast_pow5 follow that mode; the *_accurate and *_fast
+// variants are always available, with their error bounds below (the kernel bench checks every
+// variant against its bound). Every variant is branch-free straight-line code (selects, min/max,
+// no tables), so loops over them vectorize.
+//
+// sqrt stays std::sqrt in every mode: it is a single correctly rounded instruction that already
+// vectorizes, and the only cheaper hardware estimate is single precision.
+
+#ifndef RT_FAST_MATH
+#define RT_FAST_MATH 0
+#endif
+
+namespace fast_math_detail {
+
+inline double reduce_half_pi(double x) {
+    // x reduced to [-pi, pi] and reflected into [-pi/2, pi/2], keeping its sine.
+    const double round_magic = 0x1.8p52;  // Adding it rounds to an integer (|x| < 2^51)
+    double turns = (x * (1 / (2*pi)) + round_magic) - round_magic;
+    double r = x - turns * (2*pi);
+    return std::fabs(r) > pi/2 ? std::copysign(pi, r) - r : r;
+}
+
+inline double atan_unit(double a, bool accurate) {
+    // atan on [0,1]: odd minimax fits of degree 23 (2.2e-11) and 9 (1.1e-5).
+    double a2 = a*a;
+    if (accurate)
+        return a * (0.99999999943026352 + a2*(-0.33333327040946203 + a2*(0.1999979354402856
+             + a2*(-0.14282551425874504 + a2*(0.11083671277601828 + a2*(-0.089411189721408837
+             + a2*(0.071430756576355225 + a2*(-0.052514569412145433 + a2*(0.032232575679138349
+             + a2*(-0.014721219605084566 + a2*(0.0042936467343735749
+             + a2*(-0.00058769985426080187))))))))))));
+    return a * (0.99986633201679942 + a2*(-0.33030479790348283 + a2*(0.18015930163110527
+         + a2*(-0.085156329909001266 + a2*0.020845095803256639))));
+}
+
+inline double atan2_poly(double y, double x, bool accurate) {
+    double ax = std::fabs(x), ay = std::fabs(y);
+    double hi = std::fmax(ax, ay), lo = std::fmin(ax, ay);
+    double r = atan_unit(hi > 0 ? lo / hi : 0, accurate);
+    r = ay > ax ? pi/2 - r : r;
+    r = x < 0 ? pi - r : r;
+    return std::copysign(r, y);
+}
+
+} // namespace fast_math_detail
+
+inline double fast_sin_accurate(double x) {
+    // Odd minimax fit of degree 13 on [-pi/2, pi/2] (4e-14).
+    double r = fast_math_detail::reduce_half_pi(x), r2 = r*r;
+    return r * (0.99999999999962463 + r2*(-0.16666666666098079 + r2*(0.0083333333084133297
+         + r2*(-0.00019841265023865261 + r2*(2.7556840861761805e-06 + r2*(-2.5026635914197822e-08
+         + r2*1.5365931890838697e-10))))));
+}
+
+inline double fast_sin_fast(double x) {
+    // Odd minimax fit of degree 5 on [-pi/2, pi/2] (6.8e-5).
+    double r = fast_math_detail::reduce_half_pi(x), r2 = r*r;
+    return r * (0.99969678622493097 + r2*(-0.16567309727968826 + r2*0.0075143825392606891));
+}
+
+inline double fast_acos_accurate(double x) {
+    // Abramowitz and Stegun 4.4.46 (2e-8), mirrored for negative x.
+    double a = std::fabs(x);
+    double r = std::sqrt(std::fmax(0.0, 1 - a)) * (1.5707963050 + a*(-0.2145988016 + a*(0.0889789874
+             + a*(-0.0501743046 + a*(0.0308918810 + a*(-0.0170881256 + a*(0.0066700901
+             + a*-0.0012624911)))))));
+    return x < 0 ? pi - r : r;
+}
+
+inline double fast_acos_fast(double x) {
+    // Abramowitz and Stegun 4.4.45 (6.7e-5), mirrored for negative x.
+    double a = std::fabs(x);
+    double r = std::sqrt(std::fmax(0.0, 1 - a)) * (1.5707288 + a*(-0.2121144 + a*(0.0742610 + a*-0.0187293)));
+    return x < 0 ? pi - r : r;
+}
+
+inline double fast_atan2_accurate(double y, double x) { return fast_math_detail::atan2_poly(y, x, true); }
+inline double fast_atan2_fast(double y, double x) { return fast_math_detail::atan2_poly(y, x, false); }
+
+inline double fast_pow5_exact(double x) {
+    // Three multiplies; within an ulp or two of pow(x, 5), so both modes use it.
+    double x2 = x*x;
+    return x2*x2*x;
+}
+
+// Largest absolute error of each variant against libm, over the argument ranges shading uses
+// (|x| up to a few hundred for sin).
+inline constexpr double fast_sin_accurate_error = 1e-12, fast_sin_fast_error = 1e-4;
+inline constexpr double fast_acos_accurate_error = 1e-7, fast_acos_fast_error = 1e-4;
+inline constexpr double fast_atan2_accurate_error = 1e-10, fast_atan2_fast_error = 2e-5;
+inline constexpr double fast_pow5_exact_error = 1e-15;
+
+inline double fast_sin(double x) {
+#if RT_FAST_MATH == 1
+    return fast_sin_accurate(x);
+#elif RT_FAST_MATH == 2
+    return fast_sin_fast(x);
+#else
+    return std::sin(x);
+#endif
+}
+
+inline double fast_acos(double x) {
+#if RT_FAST_MATH == 1
+    return fast_acos_accurate(x);
+#elif RT_FAST_MATH == 2
+    return fast_acos_fast(x);
+#else
+    return std::acos(x);
+#endif
+}
+
+inline double fast_atan2(double y, double x) {
+#if RT_FAST_MATH == 1
+    return fast_atan2_accurate(y, x);
+#elif RT_FAST_MATH == 2
+    return fast_atan2_fast(y, x);
+#else
+    return std::atan2(y, x);
+#endif
+}
+
+inline double fast_pow5(double x) {
+#if RT_FAST_MATH
+    return fast_pow5_exact(x);
+#else
+    return std::pow(x, 5);
+#endif
+}
+
+#endif
@@ -3,14 +3,19 @@
 
 #include "constUtilFuncs.h"
 #include "aabb.h"
+#include "render_stats.h"
+
+#include <vector>
 
 class material;
+class hittable;
 
 class hit_record {
 public:
 	point3 p;
 	vec3 normal;
 	shared_ptr<material> mat;
+	const hittable* object = nullptr;  // Primitive that was hit
 	double t;
 	double u;
     double v;
@@ -26,6 +31,16 @@ public:
 	}
 };
 
+struct emitter_bounds {
+	// Where an emitter is, which way it faces and how bright it is, for light sampling.
+	aabb   bounds;
+	vec3   axis = vec3(0,0,1);  // Center of the cone of surface normals
+	double cos_theta_o = 1;     // Normals lie within acos(cos_theta_o) of axis
+	double cos_theta_e = 0;     // Light leaves within acos(cos_theta_e) of the normal (pi/2: diffuse)
+	double power = 0;           // Total emitted power (average radiance times area times pi)
+	bool   two_sided = false;   // Emits from both sides of each normal
+};
+
 class hittable {
 public:
 	virtual ~hittable() = default;
@@ -33,6 +48,45 @@ public:
 	virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
 	virtual aabb bounding_box() const = 0;
+
+	// Motion blur. motion_bounds() gives boxes at time 0 and 1 whose linear interpolation holds
+	// the primitive at every time in between; bounding_box() stays the box over all of them.
+	virtual bool has_motion() const { return false; }
+
+	virtual void motion_bounds(aabb& start, aabb& end) const { start = end = bounding_box(); }
+
+	// Any-hit query for visibility rays: true if anything intersects r within ray_t. Unlike
+	// hit() it may stop at the first intersection found and fills in no hit record.
+	virtual bool occluded(const ray& r, interval ray_t) const {
+		hit_record rec;
+		return hit(r, ray_t, rec);
+	}
+
+	// Light sampling. pdf_value() is the solid-angle density with which random() picks the
+	// direction from origin, or 0 where the primitive is not sampled from there.
+	virtual double pdf_value(const point3& origin, const vec3& direction) const { return 0.0; }
+
+	virtual vec3 random(const point3& origin) const { return vec3(1,0,0); }
+
+	virtual void collect_emitters(std::vector<const hittable*>& emitters) const {}
+
+	// Flattening, for structures built over leaf primitives. A container appends the primitives
+	// under it and returns true; a primitive returns false, and add_primitives() keeps it as is.
+	virtual bool collect_primitives(std::vector<shared_ptr<hittable>>& primitives) const { return false; }
+
+	static void add_primitives(const shared_ptr<hittable>& object, std::vector<shared_ptr<hittable>>& primitives) {
+		if (!object->collect_primitives(primitives))
+			primitives.push_back(object);
+	}
+
+	virtual emitter_bounds emission_bounds() const { return emitter_bounds(); }
+
+	// Photon emission. sample_surface() maps (s, t) in [0,1)^2 evenly over the surface and fills
+	// in the point, its outward normal and texture coordinates; surface_area() is 0 for
+	// primitives that cannot be sampled this way.
+	virtual double surface_area() const { return 0.0; }
+
+	virtual void sample_surface(double s, double t, hit_record& rec) const {}
 };
 
 #endif
\ No newline at end of file
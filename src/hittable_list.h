@@ -39,8 +39,43 @@ public:
 		return hit_anything;
 	}
 
+	bool occluded(const ray& r, interval ray_t) const override {
+		for (const auto& object : objects)
+			if (object->occluded(r, ray_t))
+				return true;
+		return false;
+	}
+
 	aabb bounding_box() const override { return bbox; }
 
+	bool has_motion() const override {
+		for (const auto& object : objects)
+			if (object->has_motion())
+				return true;
+		return false;
+	}
+
+	void motion_bounds(aabb& start, aabb& end) const override {
+		start = end = aabb();
+		for (const auto& object : objects) {
+			aabb s, e;
+			object->motion_bounds(s, e);
+			start = aabb(start, s);
+			end = aabb(end, e);
+		}
+	}
+
+	void collect_emitters(std::vector<const hittable*>& emitters) const override {
+		for (const auto& object : objects)
+			object->collect_emitters(emitters);
+	}
+
+	bool collect_primitives(std::vector<shared_ptr<hittable>>& primitives) const override {
+		for (const auto& object : objects)
+			add_primitives(object, primitives);
+		return true;
+	}
+
 private:
     aabb bbox;
 };
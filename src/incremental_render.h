@@ -0,0 +1,162 @@
+#ifndef INCREMENTAL_RENDER_H
+#define INCREMENTAL_RENDER_H
+
+#include "constUtilFuncs.h"
+
+#include "camera.h"
+#include "color.h"
+#include "execution_context.h"
+#include "hittable.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include <tbb/parallel_for.h>
+
+// Region-of-interest and incremental rendering for look-dev.
+//
+// The renderer keeps a framebuffer of per-pixel sample sums split into tiles, each either clean
+// or dirty. render() and render_region() trace only dirty tiles (all of them at first), so a
+// region can be rendered without paying for the rest of the frame. While tracing, every tile
+// records which objects and materials its camera rays hit first; invalidate() uses that map to
+// mark just the tiles where a changed object or material is directly visible, and the next
+// render() redoes only those. Pixels come out exactly as camera::render would give them.
+//
+// Only the first hit is tracked: a changed object still shows up in other tiles' reflections,
+// refractions, shadows and lighting. Invalidate a region (or everything) when that matters, and
+// after changing the camera itself. Any invalidation also has the next render rebuild the light
+// BVH, guide and photon map, which an edit may have changed.
+
+class incremental_renderer {
+public:
+    incremental_renderer(const camera& settings, int _tile_size = 16)
+      : cam(settings), tile_size(_tile_size) {
+        cam.show_progress = false;
+        width = cam.image_width;
+        height = cam.height();
+        tiles_x = (width + tile_size - 1) / tile_size;
+        tiles_y = (height + tile_size - 1) / tile_size;
+        image = first_touch_buffer<color>(size_t(width) * height);
+        footprints.resize(size_t(tiles_x) * tiles_y);
+        dirty.assign(footprints.size(), 1);
+    }
+
+    int image_width() const { return width; }
+    int image_height() const { return height; }
+    size_t dirty_tiles() const { return std::count(dirty.begin(), dirty.end(), 1); }
+    uint64_t last_rays_traced() const { return rays_traced; }
+
+    void invalidate_all() {
+        cam.forget_prepared();
+        std::fill(dirty.begin(), dirty.end(), 1);
+    }
+
+    void invalidate_region(int x0, int y0, int x1, int y1) {
+        cam.forget_prepared();
+        for_tiles(x0, y0, x1, y1, [&](int t) { dirty[t] = 1; });
+    }
+
+    size_t invalidate(const hittable* object) {
+        // Marks the tiles where object was directly visible; returns how many were clean.
+        return invalidate_tiles(object_tiles, object);
+    }
+
+    size_t invalidate(const material* mat) {
+        return invalidate_tiles(material_tiles, mat);
+    }
+
+    size_t render(const hittable& world) {
+        return render_region(world, 0, 0, width, height);
+    }
+
+    size_t render_region(const hittable& world, int x0, int y0, int x1, int y1) {
+        // Traces the dirty tiles overlapping [x0,x1) x [y0,y1); returns how many there were.
+        std::vector<int> work;
+        for_tiles(x0, y0, x1, y1, [&](int t) { if (dirty[t]) work.push_back(t); });
+        rays_traced = 0;
+        if (work.empty())
+            return 0;
+
+        std::atomic<uint64_t> ray_count(0);
+        run_in_context(cam.execution, [&] {
+            cam.prepare(world);
+            tbb::parallel_for(size_t(0), work.size(), [&](size_t k) {
+                int t = work[k];
+                int tx = t % tiles_x, ty = t / tiles_x;
+                uint64_t rays = 0;
+                footprints[t] = tile_footprint();
+                cam.trace_tile(world, tx * tile_size, ty * tile_size, std::min((tx + 1) * tile_size, width),
+                               std::min((ty + 1) * tile_size, height), image.data(), rays, &footprints[t]);
+                dirty[t] = 0;
+                ray_count += rays;
+            });
+        });
+        rays_traced = ray_count;
+        rebuild_maps();
+        return work.size();
+    }
+
+    void write(std::ostream& out) const {
+        write_region(out, 0, 0, width, height);
+    }
+
+    void write_region(std::ostream& out, int x0, int y0, int x1, int y1) const {
+        // PPM of [x0,x1) x [y0,y1) from the framebuffer; dirty tiles show their last result.
+        x0 = std::clamp(x0, 0, width);  x1 = std::clamp(x1, x0, width);
+        y0 = std::clamp(y0, 0, height); y1 = std::clamp(y1, y0, height);
+        out << "P3\n" << (x1 - x0) << ' ' << (y1 - y0) << "\n255\n";
+        for (int j = y0; j < y1; j++)
+            for (int i = x0; i < x1; i++)
+                write_color(out, image[size_t(j) * width + i], cam.samples_per_pixel);
+    }
+
+private:
+    camera cam;
+    int tile_size;
+    int width, height;
+    int tiles_x, tiles_y;
+    first_touch_buffer<color> image;        // Sample sums, row-major; pages placed by first render
+    std::vector<tile_footprint> footprints; // Per tile, from its latest trace
+    std::vector<char> dirty;
+    uint64_t rays_traced = 0;
+
+    // Inverse of the footprints: tiles where each object or material was seen first.
+    std::unordered_map<const void*, std::vector<int>> object_tiles;
+    std::unordered_map<const void*, std::vector<int>> material_tiles;
+
+    template <typename F>
+    void for_tiles(int x0, int y0, int x1, int y1, F&& f) const {
+        x0 = std::max(x0, 0); y0 = std::max(y0, 0);
+        x1 = std::min(x1, width); y1 = std::min(y1, height);
+        if (x0 >= x1 || y0 >= y1) return;
+        for (int ty = y0 / tile_size; ty <= (y1 - 1) / tile_size; ty++)
+            for (int tx = x0 / tile_size; tx <= (x1 - 1) / tile_size; tx++)
+                f(ty * tiles_x + tx);
+    }
+
+    size_t invalidate_tiles(const std::unordered_map<const void*, std::vector<int>>& map, const void* key) {
+        cam.forget_prepared();
+        auto found = map.find(key);
+        if (found == map.end()) return 0;
+        size_t marked = 0;
+        for (int t : found->second) {
+            marked += !dirty[t];
+            dirty[t] = 1;
+        }
+        return marked;
+    }
+
+    void rebuild_maps() {
+        object_tiles.clear();
+        material_tiles.clear();
+        for (int t = 0; t < int(footprints.size()); t++) {
+            for (auto* object : footprints[t].objects) object_tiles[object].push_back(t);
+            for (auto* mat : footprints[t].materials) material_tiles[mat].push_back(t);
+        }
+    }
+};
+
+#endif
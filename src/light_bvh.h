@@ -0,0 +1,315 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include "constUtilFuncs.h"
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+// Light hierarchy for next-event estimation with many lights (Conty Estevez and Kulla 2018, as
+// in pbrt-v4).
+//
+// Emitters are grouped into a binary tree whose nodes bound their lights' positions, their cone
+// of emission directions and their total power. A light is picked by walking down from the root,
+// choosing each child with probability proportional to a conservative estimate of how much it
+// could contribute at the shading point, so picking costs O(log n) and nearby, bright lights
+// facing the point are chosen most often. pmf() retraces the same walk for a given light, which
+// multiple importance sampling needs when a BSDF ray happens to hit a light.
+
+namespace light_bvh_detail {
+
+inline double safe_sqrt(double x) { return sqrt(fmax(0.0, x)); }
+
+inline double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+    // cos(max(0, a - b))
+    if (cos_a > cos_b) return 1;
+    return cos_a*cos_b + sin_a*sin_b;
+}
+
+inline point3 center(const aabb& box) {
+    return point3((box.x.min + box.x.max) / 2, (box.y.min + box.y.max) / 2, (box.z.min + box.z.max) / 2);
+}
+
+inline vec3 diagonal(const aabb& box) {
+    return vec3(box.x.size(), box.y.size(), box.z.size());
+}
+
+inline double surface_area(const aabb& box) {
+    auto d = diagonal(box);
+    return 2 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+}
+
+inline vec3 rotate(const vec3& v, const vec3& axis, double angle) {
+    // Rodrigues' rotation of v around the unit vector axis.
+    return v*cos(angle) + cross(axis, v)*sin(angle) + axis*dot(axis, v)*(1 - cos(angle));
+}
+
+inline void cone_union(const vec3& axis_a, double cos_a, const vec3& axis_b, double cos_b,
+                       vec3& axis, double& cos_theta) {
+    // Smallest cone around both cones.
+    double theta_a = acos(std::clamp(cos_a, -1.0, 1.0));
+    double theta_b = acos(std::clamp(cos_b, -1.0, 1.0));
+    double theta_d = acos(std::clamp(dot(axis_a, axis_b), -1.0, 1.0));
+
+    if (fmin(theta_d + theta_b, pi) <= theta_a) { axis = axis_a; cos_theta = cos_a; return; }
+    if (fmin(theta_d + theta_a, pi) <= theta_b) { axis = axis_b; cos_theta = cos_b; return; }
+
+    double theta_o = (theta_a + theta_d + theta_b) / 2;
+    vec3 rotation_axis = cross(axis_a, axis_b);
+    if (theta_o >= pi || rotation_axis.length_squared() < 1e-20) {
+        axis = axis_a;
+        cos_theta = -1;
+        return;
+    }
+    axis = rotate(axis_a, unit_vector(rotation_axis), theta_o - theta_a);
+    cos_theta = cos(theta_o);
+}
+
+inline emitter_bounds merge(const emitter_bounds& a, const emitter_bounds& b) {
+    if (a.power == 0) return b;
+    if (b.power == 0) return a;
+
+    emitter_bounds m;
+    m.bounds = aabb(a.bounds, b.bounds);
+    cone_union(a.axis, a.cos_theta_o, b.axis, b.cos_theta_o, m.axis, m.cos_theta_o);
+    m.cos_theta_e = fmin(a.cos_theta_e, b.cos_theta_e);
+    m.power = a.power + b.power;
+    m.two_sided = a.two_sided || b.two_sided;
+    return m;
+}
+
+inline double orientation_measure(const emitter_bounds& e) {
+    // Solid angle of all directions light can leave in, for the build's split cost.
+    double theta_o = acos(std::clamp(e.cos_theta_o, -1.0, 1.0));
+    double theta_e = acos(std::clamp(e.cos_theta_e, -1.0, 1.0));
+    double theta_w = fmin(theta_o + theta_e, pi);
+    double sin_o = sin(theta_o);
+    return 2*pi*(1 - e.cos_theta_o)
+         + pi/2 * (2*theta_w*sin_o - cos(theta_o - 2*theta_w) - 2*theta_o*sin_o + e.cos_theta_o);
+}
+
+inline double importance(const emitter_bounds& e, const point3& p, const vec3& n) {
+    // Upper bound on the light reaching p (with surface normal n) from anything inside e.
+    if (e.power == 0) return 0;
+
+    point3 pc = center(e.bounds);
+    vec3 to_p = p - pc;
+    double d2 = to_p.length_squared();
+    double radius2 = diagonal(e.bounds).length_squared() / 4;
+    vec3 wi = d2 > 0 ? to_p / sqrt(d2) : e.axis;
+
+    // Angle subtended by the bounds' bounding sphere (everything, from inside it).
+    double cos_theta_b = d2 > radius2 ? safe_sqrt(1 - radius2 / d2) : -1;
+    double sin_theta_b = safe_sqrt(1 - cos_theta_b*cos_theta_b);
+    d2 = fmax(d2, diagonal(e.bounds).length() / 2);
+
+    // Smallest angle between the direction to p and any emitting normal, shrunk by the bounds.
+    double cos_theta_w = dot(e.axis, wi);
+    if (e.two_sided) cos_theta_w = fabs(cos_theta_w);
+    double sin_theta_w = safe_sqrt(1 - cos_theta_w*cos_theta_w);
+    double sin_theta_o = safe_sqrt(1 - e.cos_theta_o*e.cos_theta_o);
+    double cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, e.cos_theta_o);
+    double sin_theta_x = safe_sqrt(1 - cos_theta_x*cos_theta_x);
+    double cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta_p <= e.cos_theta_e)
+        return 0;
+
+    double result = e.power * cos_theta_p / d2;
+
+    // Smallest incidence angle at p.
+    if (n.length_squared() > 0) {
+        double cos_theta_i = fabs(dot(wi, n));
+        double sin_theta_i = safe_sqrt(1 - cos_theta_i*cos_theta_i);
+        result *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+    }
+    return fmax(result, 0.0);
+}
+
+} // namespace light_bvh_detail
+
+class light_bvh {
+public:
+    light_bvh() {}
+
+    explicit light_bvh(const hittable& world) { build(world); }
+
+    void build(const hittable& world) {
+        lights.clear();
+        nodes.clear();
+        trails.clear();
+        index_of.clear();
+
+        std::vector<const hittable*> emitters;
+        world.collect_emitters(emitters);
+
+        std::vector<emitter_bounds> bounds;
+        for (auto emitter : emitters) {
+            auto b = emitter->emission_bounds();
+            if (b.power > 0) {
+                lights.push_back(emitter);
+                bounds.push_back(b);
+            }
+        }
+        if (lights.empty())
+            return;
+
+        trails.resize(lights.size());
+        std::vector<int> order(lights.size());
+        std::iota(order.begin(), order.end(), 0);
+        build_node(bounds, order, 0, int(order.size()), 0, 0);
+
+        for (size_t i = 0; i < lights.size(); i++)
+            index_of[lights[i]] = int(i);
+    }
+
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
+
+    bool sample(const point3& p, const vec3& n, double u, const hittable*& light, double& pmf) const {
+        // Picks a light for shading point p with normal n using u in [0,1). Returns false if no
+        // light can contribute.
+        using light_bvh_detail::importance;
+        if (lights.empty()) return false;
+
+        int index = 0;
+        pmf = 1;
+        while (!nodes[index].is_leaf) {
+            int first = index + 1, second = nodes[index].index;
+            double c0 = importance(nodes[first].bounds, p, n);
+            double c1 = importance(nodes[second].bounds, p, n);
+            if (c0 == 0 && c1 == 0) return false;
+
+            double p0 = c0 / (c0 + c1);
+            if (u < p0) {
+                index = first;
+                u = fmin(u / p0, 1 - 1e-12);
+                pmf *= p0;
+            } else {
+                index = second;
+                u = fmin((u - p0) / (1 - p0), 1 - 1e-12);
+                pmf *= 1 - p0;
+            }
+        }
+        if (importance(nodes[index].bounds, p, n) == 0) return false;
+        light = lights[nodes[index].index];
+        return true;
+    }
+
+    double pmf(const point3& p, const vec3& n, const hittable* light) const {
+        // Probability that sample(p, n, ...) picks light.
+        using light_bvh_detail::importance;
+        auto found = index_of.find(light);
+        if (found == index_of.end()) return 0;
+
+        uint64_t trail = trails[found->second];
+        int index = 0;
+        double result = 1;
+        while (!nodes[index].is_leaf) {
+            int first = index + 1, second = nodes[index].index;
+            double c0 = importance(nodes[first].bounds, p, n);
+            double c1 = importance(nodes[second].bounds, p, n);
+            if (c0 == 0 && c1 == 0) return 0;
+
+            bool take_second = trail & 1;
+            result *= (take_second ? c1 : c0) / (c0 + c1);
+            index = take_second ? second : first;
+            trail >>= 1;
+        }
+        return importance(nodes[index].bounds, p, n) > 0 ? result : 0;
+    }
+
+private:
+    struct node {
+        emitter_bounds bounds;
+        int  index;   // Light index for leaves, second child for interior nodes (first is next)
+        bool is_leaf;
+    };
+
+    std::vector<const hittable*> lights;
+    std::vector<node> nodes;
+    std::vector<uint64_t> trails;  // Per light: bit k set if its path takes the second child at depth k
+    std::unordered_map<const hittable*, int> index_of;
+
+    static double split_cost(const emitter_bounds& b) {
+        using namespace light_bvh_detail;
+        return b.power * orientation_measure(b) * fmax(surface_area(b.bounds), 1e-12);
+    }
+
+    int build_node(const std::vector<emitter_bounds>& bounds, std::vector<int>& order,
+                   int start, int end, uint64_t trail, int depth) {
+        using namespace light_bvh_detail;
+        int index = int(nodes.size());
+        nodes.push_back(node());
+
+        if (end - start == 1) {
+            nodes[index] = node{ bounds[order[start]], order[start], true };
+            trails[order[start]] = trail;
+            return index;
+        }
+
+        emitter_bounds all;
+        aabb centroids;
+        for (int i = start; i < end; i++) {
+            all = merge(all, bounds[order[i]]);
+            auto c = center(bounds[order[i]].bounds);
+            centroids = aabb(centroids, aabb(c, c));
+        }
+
+        // Split with the surface area orientation heuristic over 12 buckets per axis. Past depth
+        // 32 the ranges are halved instead, which keeps every trail within 64 bits.
+        const int buckets = 12;
+        int best_axis = -1, best_split = 0;
+        double best_cost = infinity;
+        auto extent = diagonal(centroids);
+        double max_extent = fmax(extent.x(), fmax(extent.y(), extent.z()));
+        auto bucket_of = [&](int light, int axis) {
+            auto c = center(bounds[light].bounds)[axis];
+            int b = int(buckets * (c - centroids.axis(axis).min) / extent[axis]);
+            return std::clamp(b, 0, buckets - 1);
+        };
+
+        for (int axis = 0; axis < 3 && depth < 32; axis++) {
+            if (extent[axis] <= 0) continue;
+            emitter_bounds bucket[buckets];
+            for (int i = start; i < end; i++) {
+                auto& b = bucket[bucket_of(order[i], axis)];
+                b = merge(b, bounds[order[i]]);
+            }
+
+            for (int split = 1; split < buckets; split++) {
+                emitter_bounds below, above;
+                for (int b = 0; b < split; b++) below = merge(below, bucket[b]);
+                for (int b = split; b < buckets; b++) above = merge(above, bucket[b]);
+                if (below.power == 0 || above.power == 0) continue;
+                double cost = (max_extent / extent[axis]) * (split_cost(below) + split_cost(above));
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = split;
+                }
+            }
+        }
+
+        int mid = (start + end) / 2;
+        if (best_axis >= 0) {
+            mid = int(std::partition(order.begin() + start, order.begin() + end,
+                [&](int light) { return bucket_of(light, best_axis) < best_split; }) - order.begin());
+        } else if (max_extent > 0) {
+            int axis = extent.x() == max_extent ? 0 : extent.y() == max_extent ? 1 : 2;
+            std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                [&](int a, int b) { return center(bounds[a].bounds)[axis] < center(bounds[b].bounds)[axis]; });
+        }
+
+        build_node(bounds, order, start, mid, trail, depth + 1);
+        int second = build_node(bounds, order, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+        nodes[index] = node{ all, second, false };
+        return index;
+    }
+};
+
+#endif
@@ -1,198 +1,139 @@
 
 #include "constUtilFuncs.h"
 
-#include "bvh.h"
+#include "bvh_optimizer.h"
 #include "camera.h"
 #include "color.h"
+#include "compressed_bvh.h"
+#include "distributed.h"
+#include "render_server.h"
+#include "render_trace.h"
 #include "hittable_list.h"
-#include "material.h"
-#include "sphere.h"
-#include "quad.h"
-#include "texture.h"
+#include "incremental_render.h"
+#include "multi_view.h"
+#include "scenes.h"
 
 #include <cmath>
+#include <cstdio>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <tbb/parallel_for.h>
 #include <cassert>
-
-
-hittable_list random_spheres(){
-    hittable_list world;
-  
-
-    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-
-    auto ground_material =  make_shared<lambertian>(checker);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
-
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-
-                if (choose_mat < 0.05){
-                    auto eart_texture = make_shared<image_texture>("../images/earthmap.jpg");
-                    sphere_material = make_shared<lambertian>(eart_texture);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-
-                    // Add  Movement
-                    // auto center2 = center + vec3(0, random_double(0,.5), 0);
-                    // world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
-
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
+#include <cctype>
+
+
+int main(int argc, char* argv[]) {
+    // Options:
+    //   --scene <n>      scene to render (see build_scene in scenes.h; 8 and up are stress scenes)
+    //   --scene-size <n>        object count of a stress scene (default: the scene's own)
+    //   --workers <n>    render tiles in n worker processes and merge them here
+    //   --worker <i>     internal: run as worker i of a coordinator (reads jobs from stdin)
+    //   --server         keep scenes resident and render jobs read from stdin (see render_server.h)
+    //   --server-socket <path>  same, but take jobs from connections on a Unix socket
+    //   --status-file <path>    keep a JSON progress report (progress, ETA, rays/s) at path
+    //   --sampler <name>        independent, sobol (default), stratified or blue_noise
+    //   --no-light-sampling     find lights only by BSDF sampling (no next-event estimation)
+    //   --path-guiding [n]      learn incident light over n training passes (default 4) first and
+    //                           sample diffuse bounces from it as well as from the BSDF
+    //   --caustics <n>          trace n photons from the lights for a caustic photon map
+    //   --caustic-passes <p>    spread the samples over p photon maps of shrinking radius (with
+    //                           --time-budget, the first p passes each trace a new map)
+    //   --views <set>           render turntable:<n>, stereo or cubemap views of the scene in one
+    //                           batch into view_<k>.ppm instead of the single image on stdout
+    //   --threads <n>           render (and build the scene) on n threads in a task arena of their own
+    //   --numa-node <k>         keep those threads on NUMA node k (needs TBB's hwloc binding)
+    //   --pin-threads           pin each thread to one core for the whole render
+    //   --time-budget <s>       add sample passes until s seconds are spent (spp becomes the cap)
+    //   --crop <x0,y0,x1,y1>    render only the pixels in [x0,x1) x [y0,y1) and write just that crop
+    //   --optimize-bvh          restructure the scene's BVH for lower SAH cost before rendering
+    //   --bvh-file <path>       trace the scene through a compressed BVH mapped from path
+    //                           (built and written there first if path holds no valid tree)
+    int scene   = 7;
+    int workers = 0;
+    size_t scene_size = 0;
+    bool server = false;
+    std::string server_socket;
+    std::string status_file;
+    sampler_type sampling = sampler_type::sobol;
+    bool sample_lights = true;
+    int guiding_passes = 0;
+    int caustic_photons = 0;
+    int caustic_passes = 1;
+    std::string bvh_file;
+    bool optimize = false;
+    std::string view_set;
+    int crop[4] = { 0, 0, 0, 0 };
+    bool cropped = false;
+    double time_budget = 0;
+    execution_settings execution;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--scene") && i+1 < argc)        scene = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--scene-size") && i+1 < argc)    scene_size = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--workers") && i+1 < argc) workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--worker") && i+1 < argc)  return run_render_worker(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--server"))                server = true;
+        else if (!strcmp(argv[i], "--server-socket") && i+1 < argc) server_socket = argv[++i];
+        else if (!strcmp(argv[i], "--status-file") && i+1 < argc)   status_file = argv[++i];
+        else if (!strcmp(argv[i], "--sampler") && i+1 < argc
+                 && sampler_type_from_name(argv[i+1], sampling))      i++;
+        else if (!strcmp(argv[i], "--no-light-sampling"))     sample_lights = false;
+        else if (!strcmp(argv[i], "--path-guiding"))
+            guiding_passes = (i+1 < argc && isdigit(argv[i+1][0])) ? atoi(argv[++i]) : 4;
+        else if (!strcmp(argv[i], "--caustics") && i+1 < argc)       caustic_photons = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--caustic-passes") && i+1 < argc) caustic_passes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--bvh-file") && i+1 < argc) bvh_file = argv[++i];
+        else if (!strcmp(argv[i], "--threads") && i+1 < argc)   execution.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--numa-node") && i+1 < argc) execution.numa_node = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--pin-threads"))           execution.pin_threads = true;
+        else if (!strcmp(argv[i], "--time-budget") && i+1 < argc) time_budget = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--crop") && i+1 < argc
+                 && sscanf(argv[i+1], "%d,%d,%d,%d", &crop[0], &crop[1], &crop[2], &crop[3]) == 4)
+            { cropped = true; i++; }
+        else if (!strcmp(argv[i], "--optimize-bvh"))          optimize = true;
+        else if (!strcmp(argv[i], "--views") && i+1 < argc)   view_set = argv[++i];
+        else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--scene n] [--scene-size n] [--workers n] [--server | --server-socket path]"
+                      << " [--status-file path] [--sampler name] [--no-light-sampling] [--path-guiding [n]]"
+                      << " [--caustics n] [--caustic-passes p]"
+                      << " [--threads n] [--numa-node k] [--pin-threads]"
+                      << " [--views set] [--time-budget s] [--crop x0,y0,x1,y1] [--optimize-bvh] [--bvh-file path]\n";
+            return 2;
         }
     }
 
-    auto eart_texture = make_shared<image_texture>("../images/earthmap.jpg");
-    auto material1 = make_shared<lambertian>(eart_texture);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material2));
-    world.add(make_shared<sphere>(point3(4, 1, 0), -0.95, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material3));
-
-
-    world = hittable_list(make_shared<bvh_node>(world));
-
-    return world;
-};
-
-hittable_list two_spheres() {
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(0.3, color(.2, .3, .1), color(.9, .9, .9));
-
-    world.add(make_shared<sphere>(point3(0,-10, 0), 10, make_shared<lambertian>(checker)));
-    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
-    
-    return world;
-}
-
-hittable_list earth() {
-    auto earth_texture = make_shared<image_texture>("../images/earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0,0,0), 2, earth_surface);
-
-    return hittable_list(globe);
-}
-
-hittable_list two_perlin_spheres() {
-    hittable_list world;
-
-    auto pertext = make_shared<noise_texture>(1);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
-
-    return world;
-};
-
-hittable_list quads(){
-    hittable_list world;
-
-    // Materials
-    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(make_shared<quad>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
-
-    return world;
-}
-
-hittable_list cube_big_ligth(){
-    hittable_list world;
-
-    // Materials
-    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-    
-    auto earth_texture = make_shared<image_texture>("../images/earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-
-    auto ligth_material = make_shared<diffuse_light>(color(1,1,1));
-
-    // Earth
-    world.add(make_shared<sphere>(point3(0, 0, 2), 1, earth_surface));
-
-
-    // Quads
-    world.add(make_shared<quad>(point3(-2,-2, 4), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3( 2,-2, 0), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 2, 0), vec3(4, 0, 0), vec3(0, 0, 4), ligth_material));
-    world.add(make_shared<quad>(point3(-2,-2, 4), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
-
-    return world;
-}
-
-
-hittable_list cube_small_ligth(){
-    hittable_list world;
-
-    // Materials
-    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-    
-    auto earth_texture = make_shared<image_texture>("../images/earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
+    if (time_budget > 0 && (workers > 0 || server || !server_socket.empty() || cropped || !view_set.empty())) {
+        std::cerr << "--time-budget needs a local full-image render (no workers, server, crop or views)\n";
+        return 2;
+    }
 
-    auto ligth_material = make_shared<diffuse_light>(color(15,15,15));
+    if (cropped && (workers > 0 || server || !server_socket.empty())) {
+        std::cerr << "--crop needs a local render (server jobs take crop=x0,y0,x1,y1 instead)\n";
+        return 2;
+    }
 
-    // Earth
-    world.add(make_shared<sphere>(point3(0, 0, 2), 1, earth_surface));
-    
-    // Ligth
-    world.add(make_shared<quad>(point3(-1.0, 1.9, 1.0), vec3(2, 0, 0), vec3(0, 0, 2), ligth_material));
+    if (!view_set.empty() && (workers > 0 || server || !server_socket.empty())) {
+        std::cerr << "--views needs a local render (no workers or server)\n";
+        return 2;
+    }
 
-    // Quads
-    world.add(make_shared<quad>(point3(-2,-2, 4), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3( 2,-2, 0), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 2, 0), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(point3(-2,-2, 4), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
+    if ((optimize || !bvh_file.empty()) && (workers > 0 || server || !server_socket.empty())) {
+        std::cerr << "--optimize-bvh and --bvh-file need a local render: workers and the server build their own scenes\n";
+        return 2;
+    }
 
-    return world;
-}
+    if (caustic_passes > 1 && (workers > 0 || server || !server_socket.empty() || cropped || !view_set.empty())) {
+        std::cerr << "--caustic-passes needs a local full-image render: workers, server jobs, crops and views"
+                     " use one photon map\n";
+        return 2;
+    }
 
-int main() {
+    if (execution.numa_node >= 0 && !numa_node_exists(execution.numa_node)) {
+        std::cerr << "NUMA node " << execution.numa_node << " is not available\n";
+        return 2;
+    }
 
     auto start = std::chrono::high_resolution_clock::now();
 
@@ -215,17 +156,105 @@ int main() {
     cam.defocus_angle = 0.02;
     cam.focus_dist    = 10.0;
 
-    switch (7)  {
-        case 1: world = random_spheres();     break;
-        case 2: world = two_spheres();        break;
-        case 3: world = earth();              break;
-        case 4: world = two_perlin_spheres(); break;
-        case 5: world = quads();              break;
-        case 6: world = cube_big_ligth();     break;
-        case 7: world = cube_small_ligth();   break;
+    cam.status_file   = status_file;
+    cam.sampling      = sampling;
+    cam.sample_lights = sample_lights;
+    cam.path_guiding  = guiding_passes > 0;
+    cam.guiding_passes = guiding_passes;
+    cam.caustic_photons = caustic_photons;
+    cam.caustic_passes  = caustic_passes;
+    cam.time_budget   = time_budget;
+
+    cam.denoise       = false;  // Filter with the a-trous denoiser (lets spp drop to 16-32)
+
+#ifdef RT_STATS
+    cam.stats_heatmap_prefix = "heatmap";
+#endif
+
+    if (server || !server_socket.empty()) {
+        // Render settings above are the defaults for every job.
+        cam.execution = execution;
+        render_server renderer(cam);
+        if (!server_socket.empty())
+            return renderer.listen_on(server_socket);
+        renderer.serve(STDIN_FILENO, STDOUT_FILENO);  // Ends on quit or when stdin closes
+        return 0;
     }
 
-    cam.render(world);
+    if (workers > 0) {
+        // Workers build the scene themselves; the coordinator only hands out tiles.
+        render_coordinator coordinator(scene, cam, workers, scene_size);
+        coordinator.render(std::cout);
+    } else {
+        // The scene build runs in the job's arena as well, on the same threads and node.
+        int status = run_in_context(execution, [&] {
+            seed_random(cam.seed);
+            {
+                RT_TRACE_SCOPE("phase", "scene build");
+                world = build_scene(scene, scene_size);
+            }
+            std::chrono::duration<double, std::milli> built = std::chrono::high_resolution_clock::now() - start;
+            std::clog << "Scene built in " << built.count() << " ms\n";
+            if (optimize) {
+                RT_TRACE_SCOPE("phase", "BVH optimize");
+                optimize_bvh(world);
+            }
+            if (!bvh_file.empty()) {
+                auto tree = compressed_bvh::load(bvh_file, world);
+                if (!tree) {
+                    if (access(bvh_file.c_str(), F_OK) == 0)
+                        std::clog << "Compressed BVH in " << bvh_file << " does not match this scene; rebuilding it\n";
+                    compressed_bvh(world).save(bvh_file);
+                    tree = compressed_bvh::load(bvh_file, world);
+                }
+                if (tree) {
+                    std::clog << "Compressed BVH: " << tree->node_bytes() << " bytes of nodes mapped from "
+                              << bvh_file << '\n';
+                    world = hittable_list(tree);
+                } else {
+                    std::clog << "Could not write a compressed BVH to " << bvh_file << '\n';
+                }
+            }
+            if (cropped) {
+                incremental_renderer region(cam);
+                region.render_region(world, crop[0], crop[1], crop[2], crop[3]);
+                region.write_region(std::cout, crop[0], crop[1], crop[2], crop[3]);
+            } else if (view_set.empty()) {
+                cam.render(world);
+                if (time_budget > 0) {
+                    const auto& report = cam.last_deadline();
+                    std::clog << "Deadline: " << report.samples << " spp in " << report.passes << " passes, "
+                              << int(1000 * report.seconds) << " of " << int(1000 * time_budget) << " ms"
+                              << (report.overrun ? " (over budget)" : "") << ", noise "
+                              << report.noise << " (" << 100 * report.noise / fmax(report.mean_luminance, 1e-12)
+                              << "% of mean luminance)\n";
+                }
+            } else {
+                std::vector<camera> cameras;
+                if (view_set.rfind("turntable:", 0) == 0)
+                    cameras = turntable_views(cam, std::max(1, atoi(view_set.c_str() + 10)));
+                else if (view_set == "stereo")
+                    cameras = stereo_views(cam, 0.065 * cam.focus_dist);
+                else if (view_set == "cubemap")
+                    cameras = cube_map_views(cam);
+                else {
+                    std::cerr << "Unknown view set '" << view_set << "' (turntable:<n>, stereo or cubemap)\n";
+                    return 2;
+                }
+
+                std::vector<std::ofstream> files;
+                std::vector<render_view> views;
+                for (size_t k = 0; k < cameras.size(); k++)
+                    files.emplace_back("view_" + std::to_string(k) + ".ppm");
+                for (size_t k = 0; k < cameras.size(); k++)
+                    views.push_back({ cameras[k], &files[k] });
+                render_views(world, views, cam.show_progress);
+            }
+            return 0;
+        });
+        if (status != 0)
+            return status;
+    }
 
 
     auto end = std::chrono::high_resolution_clock::now();
@@ -234,4 +263,9 @@ int main() {
 
     // Output the duration
     std::clog << "Execution time: " << duration.count() << " milliseconds" << std::endl;
+
+#ifdef RT_TRACE
+    trace_recorder::instance().print_summary(std::clog);
+    trace_recorder::instance().write_chrome_trace("trace.json");
+#endif
 }
\ No newline at end of file
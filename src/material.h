@@ -2,6 +2,8 @@
 #define MATERIAL_H
 
 #include "constUtilFuncs.h"
+#include "fast_math.h"
+#include "sampler.h"
 #include "texture.h"
 
 class hit_record;
@@ -16,6 +18,17 @@ public:
 
 	virtual bool scatter(
 		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+
+	virtual color aov_albedo(const hit_record& rec) const {
+		// Surface color written to the albedo AOV that guides the denoiser.
+		return color(1,1,1);
+	}
+
+	// Emitters are collected for light sampling.
+	virtual bool is_emissive() const { return false; }
+
+	// Diffuse materials reflect attenuation/pi, scatter with density cos/pi, and sample lights.
+	virtual bool is_diffuse() const { return false; }
 };
 
 class lambertian : public material {
@@ -25,7 +38,7 @@ public:
 
 	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
 	const override {
-		auto scatter_direction = rec.normal + random_unit_vector();
+		auto scatter_direction = rec.normal + sample_unit_vector();
 
 		// Catch degenerate scatter direction
 		if (scatter_direction.near_zero())
@@ -36,6 +49,12 @@ public:
 		return true;
 	}
 
+	color aov_albedo(const hit_record& rec) const override {
+		return albedo->value(rec.u, rec.v, rec.p);
+	}
+
+	bool is_diffuse() const override { return true; }
+
 private:
 	// color albedo;
 	shared_ptr<texture> albedo;
@@ -48,11 +67,13 @@ public:
 	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
 	const override {
 		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-		scattered = ray(rec.p, reflected + fuzz*random_unit_vector(), r_in.time());
+		scattered = ray(rec.p, reflected + fuzz*sample_unit_vector(), r_in.time());
 		attenuation = albedo;
 		return (dot(scattered.direction(), rec.normal) > 0);
 	}
 
+	color aov_albedo(const hit_record& rec) const override { return albedo; }
+
 private:
 	color albedo;
 	double fuzz;
@@ -73,7 +94,7 @@ public:
 
 		bool cannot_refract = refraction_ratio * sin_theta > 1.0;
 		vec3 direction;
-		if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
+		if (cannot_refract || reflectance(cos_theta, refraction_ratio) > sample_1d())
 			direction = reflect(unit_direction, rec.normal);
 		else
 			direction = refract(unit_direction, rec.normal, refraction_ratio);
@@ -89,7 +110,7 @@ private:
 		// Use Schlick's approximation for reflectance.
 		auto r0 = (1-ref_idx) / (1+ref_idx);
 		r0 = r0*r0;
-		return r0 + (1-r0)*pow((1 - cosine),5);
+		return r0 + (1-r0)*fast_pow5(1 - cosine);
 	}
 };
 
@@ -107,6 +128,13 @@ class diffuse_light : public material {
         return emit->value(u, v, p);
     }
 
+    color aov_albedo(const hit_record& rec) const override {
+        auto e = emit->value(rec.u, rec.v, rec.p);
+        return color(fmin(e.x(), 1.0), fmin(e.y(), 1.0), fmin(e.z(), 1.0));
+    }
+
+    bool is_emissive() const override { return true; }
+
   private:
     shared_ptr<texture> emit;
 };
@@ -0,0 +1,151 @@
+#ifndef MULTI_VIEW_H
+#define MULTI_VIEW_H
+
+#include "constUtilFuncs.h"
+
+#include "camera.h"
+#include "hittable.h"
+#include "render_progress.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <tbb/parallel_pipeline.h>
+#include <tbb/task_arena.h>
+
+// Batch rendering of several views of one scene.
+//
+// Every view is cut into tiles and all tiles go through one TBB pipeline, view after view, so
+// the tail of one view overlaps the start of the next and no core idles between them. The
+// scene, its textures and BVH are shared as they are; the light BVH is built once and lent to
+// every view. A view's image buffer exists only from its first tile until its last tile is done,
+// when the image is written to the view's stream; with the pipeline's bounded number of tiles
+// in flight only a few views are ever open at once.
+//
+// Views render plain images: the denoiser and AOV outputs are single-view features of
+// camera::render. Pixels come out exactly as a camera::render of the same view would give them.
+
+struct render_view {
+    camera cam;
+    std::ostream* out = nullptr;    // Receives the finished PPM
+};
+
+inline uint64_t render_views(const hittable& world, std::vector<render_view>& views,
+                             bool show_progress = true, int tile_size = 32) {
+    // Renders every view and returns the number of rays traced.
+    struct tile {
+        int view, x0, y0, x1, y1;
+    };
+    std::vector<tile> tiles;
+    for (int v = 0; v < int(views.size()); v++) {
+        auto& cam = views[v].cam;
+        cam.prepare(world, v > 0 ? &views[0].cam : nullptr);
+        int w = cam.image_width, h = cam.height();
+        for (int y = 0; y < h; y += tile_size)
+            for (int x = 0; x < w; x += tile_size)
+                tiles.push_back({ v, x, y, std::min(x + tile_size, w), std::min(y + tile_size, h) });
+    }
+    if (tiles.empty())
+        return 0;
+
+    std::vector<std::vector<color>> images(views.size());
+    std::vector<int> tiles_left(views.size(), 0);
+    for (const auto& t : tiles)
+        tiles_left[t.view]++;
+
+    render_progress progress;
+    progress.start(int(tiles.size()), show_progress, views[0].cam.status_file);
+
+    size_t tiles_in_flight = 4 * std::max(1, tbb::this_task_arena::max_concurrency());
+    size_t next_tile = 0;
+
+    tbb::parallel_pipeline(tiles_in_flight,
+        tbb::make_filter<void, size_t>(tbb::filter_mode::serial_in_order,
+            [&](tbb::flow_control& fc) -> size_t {
+                if (next_tile == tiles.size()) {
+                    fc.stop();
+                    return 0;
+                }
+                // A view's buffer is allocated when its first tile enters the pipeline.
+                auto& image = images[tiles[next_tile].view];
+                if (image.empty()) {
+                    const auto& cam = views[tiles[next_tile].view].cam;
+                    image.resize(size_t(cam.image_width) * cam.height());
+                }
+                return next_tile++;
+            })
+        & tbb::make_filter<size_t, size_t>(tbb::filter_mode::parallel,
+            [&](size_t index) {
+                const auto& t = tiles[index];
+                auto start = std::chrono::steady_clock::now();
+                uint64_t rays = 0;
+                views[t.view].cam.trace_tile(world, t.x0, t.y0, t.x1, t.y1, images[t.view].data(), rays);
+                progress.add_busy_time(std::chrono::steady_clock::now() - start);
+                progress.row_done(rays);
+                return index;
+            })
+        & tbb::make_filter<size_t, void>(tbb::filter_mode::serial_out_of_order,
+            [&](size_t index) {
+                int v = tiles[index].view;
+                if (--tiles_left[v] > 0)
+                    return;
+                if (views[v].out)
+                    views[v].cam.write_image(*views[v].out, images[v]);
+                std::vector<color>().swap(images[v]);
+            }));
+    progress.finish();
+    return progress.rays_traced();
+}
+
+// View sets for the usual batch jobs, all derived from one base camera.
+
+inline std::vector<camera> turntable_views(const camera& base, int count) {
+    // `count` views orbiting lookat about the vup axis, evenly spaced, starting at the base view.
+    std::vector<camera> views;
+    auto axis = unit_vector(base.vup);
+    auto offset = base.lookfrom - base.lookat;
+    for (int k = 0; k < count; k++) {
+        auto angle = 2 * pi * k / count;
+        auto rotated = offset * cos(angle) + cross(axis, offset) * sin(angle)
+                     + axis * dot(axis, offset) * (1 - cos(angle));
+        views.push_back(base);
+        views.back().lookfrom = base.lookat + rotated;
+    }
+    return views;
+}
+
+inline std::vector<camera> stereo_views(const camera& base, double eye_separation) {
+    // Left and right eye, parallel, each shifted half the separation from the base position.
+    auto right = unit_vector(cross(base.lookat - base.lookfrom, base.vup));
+    std::vector<camera> views(2, base);
+    for (int eye = 0; eye < 2; eye++) {
+        auto shift = (eye == 0 ? -0.5 : 0.5) * eye_separation * right;
+        views[eye].lookfrom = base.lookfrom + shift;
+        views[eye].lookat = base.lookat + shift;
+    }
+    return views;
+}
+
+inline std::vector<camera> cube_map_views(const camera& base) {
+    // The six 90 degree square faces around lookfrom, in +x, -x, +y, -y, +z, -z order.
+    static const vec3 directions[6] = { vec3(1,0,0), vec3(-1,0,0), vec3(0,1,0),
+                                        vec3(0,-1,0), vec3(0,0,1), vec3(0,0,-1) };
+    static const vec3 ups[6] = { vec3(0,1,0), vec3(0,1,0), vec3(0,0,-1),
+                                 vec3(0,0,1), vec3(0,1,0), vec3(0,1,0) };
+    std::vector<camera> views;
+    for (int face = 0; face < 6; face++) {
+        views.push_back(base);
+        auto& cam = views.back();
+        cam.aspect_ratio = 1;
+        cam.vfov = 90;
+        cam.defocus_angle = 0;
+        cam.lookat = base.lookfrom + directions[face];
+        cam.vup = ups[face];
+    }
+    return views;
+}
+
+#endif
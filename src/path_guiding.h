@@ -0,0 +1,306 @@
+#ifndef PATH_GUIDING_H
+#define PATH_GUIDING_H
+
+#include "constUtilFuncs.h"
+
+#include "aabb.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Online path guiding with a spatial-directional tree (Mueller, Gross and Novak 2017).
+//
+// Space is split by a binary tree over the scene bounds; each spatial leaf holds a quadtree over
+// directions that approximates the radiance arriving there. Directions map to the unit square by
+// (cos theta, phi), which preserves area, so a density on the square is 4 pi times the density
+// over solid angle and quadtree cells can be refined by energy alone. A leaf's points face many
+// ways (walls meet, spheres curve), so its quadtree covers the whole sphere; samples for one
+// surface are folded into that surface's hemisphere.
+//
+// The camera trains the tree over a few passes of doubling sample counts. During a pass every
+// diffuse vertex records the luminance its bounce ray brought back, divided by the pdf the ray
+// was sampled with, into its leaf's recording quadtree, while sampling from the quadtree learned
+// in the pass before. Between passes end_pass() turns the recordings into the new sampling
+// quadtrees, splits spatial leaves that saw many samples, and refines each quadtree where its
+// energy concentrates. During a pass the structure is only read, and recording is a descent
+// with relaxed atomic adds, so it is lock-free. Energy is summed in fixed point: integer adds
+// commute, so the learned distribution, and with it the image, does not depend on thread
+// scheduling.
+
+class directional_tree {
+public:
+    struct node {
+        double   energy[4] = { 0, 0, 0, 0 };  // Per quadrant: q = (u >= 1/2) + 2 (v >= 1/2)
+        uint32_t child[4] = { 0, 0, 0, 0 };   // 0: the quadrant is a leaf (the root is no child)
+    };
+
+    std::vector<node> nodes = std::vector<node>(1);
+
+    double total() const {
+        const auto& e = nodes[0].energy;
+        return e[0] + e[1] + e[2] + e[3];
+    }
+
+    vec3 sample(double u1, double u2) const {
+        // Descends by energy with the two numbers rescaled at each choice, then lands uniformly
+        // in the chosen leaf cell.
+        double x = 0, y = 0, size = 1;
+        uint32_t index = 0;
+        while (true) {
+            const auto& e = nodes[index].energy;
+            double left = e[0] + e[2], right = e[1] + e[3];
+            int column = pick(u1, left, right);
+            int row = pick(u2, e[column], e[column + 2]);
+            int q = column + 2 * row;
+            size *= 0.5;
+            x += column * size;
+            y += row * size;
+            if (!nodes[index].child[q]) break;
+            index = nodes[index].child[q];
+        }
+        return to_direction(x + u1 * size, y + u2 * size);
+    }
+
+    double pdf(const vec3& direction) const {
+        // Density over solid angle.
+        double u, v;
+        to_square(direction, u, v);
+        double density = 1;
+        uint32_t index = 0;
+        while (true) {
+            const auto& e = nodes[index].energy;
+            double sum = e[0] + e[1] + e[2] + e[3];
+            if (sum <= 0) return 0;
+            int q = quadrant(u, v);
+            density *= 4 * e[q] / sum;
+            if (!nodes[index].child[q] || density == 0) break;
+            index = nodes[index].child[q];
+        }
+        return density / (4 * pi);
+    }
+
+    vec3 sample(double u1, double u2, const vec3& normal) const {
+        // A direction in the hemisphere around normal: one from the sphere, mirrored through the
+        // surface if it points below it, so no sample is wasted on directions a diffuse surface
+        // cannot receive light from.
+        auto direction = sample(u1, u2);
+        auto below = dot(direction, normal);
+        return below < 0 ? direction - 2 * below * normal : direction;
+    }
+
+    double pdf(const vec3& direction, const vec3& normal) const {
+        // Density of sample(u1, u2, normal): both directions that fold onto this one.
+        auto along = dot(direction, normal) / direction.length();
+        if (along <= 0) return 0;
+        return pdf(direction) + pdf(unit_vector(direction) - 2 * along * normal);
+    }
+
+    static int quadrant(double& u, double& v) {
+        // The quadrant holding (u, v), which is then rescaled to that quadrant.
+        int column = u >= 0.5, row = v >= 0.5;
+        u = 2 * u - column;
+        v = 2 * v - row;
+        return column + 2 * row;
+    }
+
+    static void to_square(const vec3& direction, double& u, double& v) {
+        auto d = unit_vector(direction);
+        auto phi = atan2(d.y(), d.x());
+        u = std::clamp((d.z() + 1) / 2, 0.0, 1.0 - 1e-12);
+        v = std::clamp((phi < 0 ? phi + 2*pi : phi) / (2*pi), 0.0, 1.0 - 1e-12);
+    }
+
+    static vec3 to_direction(double u, double v) {
+        auto cos_theta = 2*u - 1;
+        auto sin_theta = sqrt(fmax(0.0, 1 - cos_theta*cos_theta));
+        auto phi = 2*pi*v;
+        return vec3(sin_theta*cos(phi), sin_theta*sin(phi), cos_theta);
+    }
+
+private:
+    static int pick(double& u, double a, double b) {
+        // Chooses 0 or 1 in proportion to a and b and rescales u to [0,1) within the choice.
+        double sum = a + b;
+        double p = sum > 0 ? a / sum : 0.5;
+        if (u < p) {
+            u = p > 0 ? u / p : 0;
+            return 0;
+        }
+        u = p < 1 ? (u - p) / (1 - p) : 0;
+        u = std::min(u, 1.0 - 1e-12);
+        return 1;
+    }
+};
+
+class sd_tree {
+public:
+    static constexpr double guided_fraction = 0.5;  // Share of diffuse bounces sampled from the tree
+
+    sd_tree(const aabb& bounds) {
+        nodes.push_back({ 0, 0, { 0, 0 }, 0, bounds });
+        leaves.push_back(std::make_unique<leaf>(directional_tree()));
+    }
+
+    const directional_tree* distribution(const point3& p) const {
+        // The learned quadtree at p, or null where nothing has been learned yet.
+        const auto& tree = leaves[find(p)]->sampling;
+        return tree.total() > 0 ? &tree : nullptr;
+    }
+
+    void record(const point3& p, const vec3& direction, double value) const {
+        // Adds a radiance estimate (luminance over sampling pdf) arriving at p from direction.
+        if (!(value > 0)) return;
+        auto& l = *leaves[find(p)];
+        l.samples.fetch_add(1, std::memory_order_relaxed);
+
+        auto amount = uint64_t(std::min(value, max_record) * fixed_point_scale);
+        double u, v;
+        directional_tree::to_square(direction, u, v);
+        uint32_t index = 0;
+        while (true) {
+            int q = directional_tree::quadrant(u, v);
+            l.recording[index].energy[q].fetch_add(amount, std::memory_order_relaxed);
+            index = l.recording[index].child[q];
+            if (!index) break;
+        }
+    }
+
+    void end_pass(int pass) {
+        // Recordings become the sampling quadtrees; busy leaves split (children start from a copy
+        // of their parent); every quadtree is refined for the next pass's recording.
+        auto split_threshold = spatial_threshold * sqrt(double(uint64_t(1) << pass));
+        size_t leaf_count = leaves.size();
+        for (size_t k = 0; k < leaf_count; k++) {
+            auto& l = *leaves[k];
+            l.sampling = l.recorded();
+            auto samples = double(l.samples.load());
+            l.reset(l.sampling);
+            split(l.node, samples, split_threshold, 0);
+        }
+    }
+
+    size_t leaf_count() const { return leaves.size(); }
+
+private:
+    static constexpr double fixed_point_scale = 65536.0;
+    static constexpr double max_record = 1e6;
+    static constexpr double spatial_threshold = 4000;   // Samples a leaf may take in pass 0
+    static constexpr double energy_threshold = 0.01;    // Share of energy that earns a subdivision
+    static constexpr int max_directional_depth = 16;
+    static constexpr int max_spatial_depth = 48;
+
+    struct spatial_node {
+        int      axis;
+        double   split;       // Position of the splitting plane along axis
+        uint32_t child[2];    // Both 0 for a leaf
+        uint32_t leaf;        // Index into leaves for a leaf
+        aabb     box;
+    };
+
+    struct recording_node {
+        std::atomic<uint64_t> energy[4];
+        uint32_t child[4];
+    };
+
+    struct leaf {
+        directional_tree sampling;
+        std::unique_ptr<recording_node[]> recording;
+        size_t recording_size = 0;
+        std::atomic<uint64_t> samples{0};
+        uint32_t node = 0;
+
+        leaf(const directional_tree& learned) : sampling(learned) { reset(learned); }
+
+        directional_tree recorded() const {
+            directional_tree tree;
+            tree.nodes.resize(recording_size);
+            for (size_t n = 0; n < recording_size; n++)
+                for (int q = 0; q < 4; q++) {
+                    tree.nodes[n].energy[q] = recording[n].energy[q].load() / fixed_point_scale;
+                    tree.nodes[n].child[q] = recording[n].child[q];
+                }
+            return tree;
+        }
+
+        void reset(const directional_tree& learned) {
+            // Empty recording quadtree, subdivided where `learned` has its energy.
+            std::vector<directional_tree::node> topology(1);
+            double total = learned.total();
+            if (total > 0)
+                refine(learned, 0, learned.nodes[0].energy, total, 1, topology, 0);
+            recording_size = topology.size();
+            recording.reset(new recording_node[recording_size]);
+            for (size_t n = 0; n < recording_size; n++)
+                for (int q = 0; q < 4; q++) {
+                    recording[n].energy[q].store(0, std::memory_order_relaxed);
+                    recording[n].child[q] = topology[n].child[q];
+                }
+            samples.store(0, std::memory_order_relaxed);
+        }
+
+        static void refine(const directional_tree& learned, int from, const double (&energy)[4],
+                           double total, int depth, std::vector<directional_tree::node>& out, uint32_t to) {
+            // Quadrants above the energy threshold get children, whose energies come from the
+            // learned tree where it has them and are spread evenly where it does not.
+            if (depth >= max_directional_depth) return;
+            for (int q = 0; q < 4; q++) {
+                if (energy[q] <= energy_threshold * total) continue;
+                int learned_child = from >= 0 ? int(learned.nodes[from].child[q]) : 0;
+                double child_energy[4];
+                for (int c = 0; c < 4; c++)
+                    child_energy[c] = learned_child ? learned.nodes[learned_child].energy[c] : energy[q] / 4;
+                auto index = uint32_t(out.size());
+                out.emplace_back();
+                out[to].child[q] = index;
+                refine(learned, learned_child ? learned_child : -1, child_energy, total, depth + 1, out, index);
+            }
+        }
+    };
+
+    std::vector<spatial_node> nodes;
+    std::vector<std::unique_ptr<leaf>> leaves;
+
+    uint32_t find(const point3& p) const {
+        uint32_t index = 0;
+        while (nodes[index].child[0])
+            index = nodes[index].child[p[nodes[index].axis] >= nodes[index].split];
+        return nodes[index].leaf;
+    }
+
+    void split(uint32_t index, double samples, double threshold, int depth) {
+        // Halves the leaf node at `index` along its box's longest axis until each part would have
+        // seen no more than `threshold` samples (assuming they spread evenly).
+        if (samples <= threshold || depth >= max_spatial_depth) return;
+        auto box = nodes[index].box;
+        int axis = box.longest_axis();
+        auto middle = 0.5 * (box.axis(axis).min + box.axis(axis).max);
+        auto lower = box, upper = box;
+        auto& lower_side = axis == 0 ? lower.x : axis == 1 ? lower.y : lower.z;
+        auto& upper_side = axis == 0 ? upper.x : axis == 1 ? upper.y : upper.z;
+        lower_side.max = middle;
+        upper_side.min = middle;
+
+        auto& old_leaf = *leaves[nodes[index].leaf];
+        auto second = uint32_t(leaves.size());
+        leaves.push_back(std::make_unique<leaf>(old_leaf.sampling));
+
+        uint32_t below = uint32_t(nodes.size()), above = below + 1;
+        nodes.push_back({ 0, 0, { 0, 0 }, nodes[index].leaf, lower });
+        nodes.push_back({ 0, 0, { 0, 0 }, second, upper });
+        old_leaf.node = below;
+        leaves[second]->node = above;
+        nodes[index].axis = axis;
+        nodes[index].split = middle;
+        nodes[index].child[0] = below;
+        nodes[index].child[1] = above;
+
+        split(below, samples / 2, threshold, depth + 1);
+        split(above, samples / 2, threshold, depth + 1);
+    }
+};
+
+#endif
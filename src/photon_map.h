@@ -0,0 +1,220 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include "constUtilFuncs.h"
+
+#include "hittable.h"
+#include "material.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+
+// Caustic photon map (Jensen 1996), made progressive by shrinking the radius from one map to the
+// next (Knaus and Zwicker 2011).
+//
+// Photons leave the scene's emitters (diffuse_light quads and spheres), chosen by power, from an
+// even point on the surface in a cosine-distributed direction. A photon bounces only off
+// non-diffuse materials (dielectric, metal); at its first diffuse surface it is stored if it
+// went through at least one of them (an L S+ D path), and dropped otherwise. So a map holds at
+// most one photon per emitted photon, and its memory is bounded by the emission count.
+//
+// Emission runs in parallel over fixed chunks of photons, each seeded from its index, and the
+// chunks' photons are concatenated in order, so a map does not depend on thread scheduling. The
+// kd-tree is built in place over the photon array (median splits along the widest axis, both
+// halves built in parallel), with no pointers or extra nodes.
+//
+// The camera gathers photons at every diffuse vertex of a path and drops the emission the path
+// finds through specular bounces after one, which the map already counts. Each
+// further map of a progressive render shrinks the radius by r_{k+1}^2 = r_k^2 (k + alpha)/(k + 1),
+// so bias and noise both go to zero while only one map is alive at a time.
+
+struct photon {
+    float position[3];
+    float power[3];      // Flux carried, in the units of emitted radiance times area
+    float direction[3];  // Direction of travel when it landed
+};
+
+class photon_map {
+public:
+    static constexpr double alpha = 2.0 / 3.0;  // Radius reduction rate between progressive maps
+
+    photon_map() = default;
+
+    photon_map(const hittable& world, size_t emitted, double _radius, uint64_t seed, int max_bounces = 16)
+      : radius(_radius)
+    {
+        std::vector<const hittable*> emitters;
+        world.collect_emitters(emitters);
+        std::vector<double> cdf;
+        double total = 0;
+        for (auto* e : emitters) {
+            total += e->surface_area() > 0 ? e->emission_bounds().power : 0;
+            cdf.push_back(total);
+        }
+        if (total <= 0 || emitted == 0)
+            return;
+
+        // Each chunk traces a fixed range of photon indices from its own seed.
+        const size_t chunk_size = 4096;
+        size_t chunks = (emitted + chunk_size - 1) / chunk_size;
+        std::vector<std::vector<photon>> stored(chunks);
+        tbb::parallel_for(size_t(0), chunks, [&](size_t c) {
+            // Materials draw from random_double() here, not from a pixel's sampler.
+            auto* pixel_sampler = current_sampler();
+            current_sampler() = nullptr;
+            seed_random(seed ^ (uint64_t(c + 1) << 32));
+            size_t end = std::min(emitted, (c + 1) * chunk_size);
+            for (size_t k = c * chunk_size; k < end; k++)
+                trace(world, emitters, cdf, total, double(emitted), max_bounces, stored[c]);
+            current_sampler() = pixel_sampler;
+        });
+
+        size_t count = 0;
+        for (auto& s : stored)
+            count += s.size();
+        photons.reserve(count);
+        for (auto& s : stored) {
+            photons.insert(photons.end(), s.begin(), s.end());
+            std::vector<photon>().swap(s);
+        }
+        axes.resize(photons.size());
+        build(0, photons.size());
+    }
+
+    bool empty() const { return photons.empty(); }
+    size_t size() const { return photons.size(); }
+    size_t bytes() const { return photons.capacity() * sizeof(photon) + axes.capacity(); }
+    double lookup_radius() const { return radius; }
+
+    static double radius_for_pass(double first_radius, int pass) {
+        // The radius of map `pass` (from 0) of a progressive render.
+        double r2 = first_radius * first_radius;
+        for (int k = 1; k <= pass; k++)
+            r2 *= (k + alpha) / (k + 1);
+        return sqrt(r2);
+    }
+
+    color radiance(const point3& p, const vec3& normal, const color& albedo) const {
+        // Caustic radiance leaving a diffuse surface at p: the flux of photons within the radius
+        // that arrived on the normal's side, over the disc's area, times the BRDF albedo/pi.
+        double r2 = radius * radius;
+        double flux[3] = { 0, 0, 0 };
+        gather(0, photons.size(), p, r2, [&](const photon& ph) {
+            if (ph.direction[0]*normal.x() + ph.direction[1]*normal.y() + ph.direction[2]*normal.z() >= 0)
+                return;
+            for (int c = 0; c < 3; c++)
+                flux[c] += ph.power[c];
+        });
+        auto scale = 1 / (pi * r2) / pi;
+        return albedo * color(flux[0], flux[1], flux[2]) * scale;
+    }
+
+private:
+    std::vector<photon> photons;     // kd-tree order: each range's median splits it
+    std::vector<unsigned char> axes; // Split axis of the photon at each range's median
+    double radius = 0;
+
+    static void trace(const hittable& world, const std::vector<const hittable*>& emitters,
+                      const std::vector<double>& cdf, double total, double emitted, int max_bounces,
+                      std::vector<photon>& out) {
+        // Picks an emitter by power, a point on it and a direction, and follows the photon.
+        auto u = random_double() * total;
+        size_t pick = std::min(size_t(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), emitters.size() - 1);
+        auto* light = emitters[pick];
+        auto pick_pdf = (cdf[pick] - (pick ? cdf[pick - 1] : 0)) / total;
+
+        hit_record start;
+        light->sample_surface(random_double(), random_double(), start);
+        auto normal = start.normal;
+        double sides = light->emission_bounds().two_sided ? 2 : 1;
+        if (sides == 2 && random_double() < 0.5)
+            normal = -normal;
+        auto direction = unit_vector(normal + sphere_from_square(random_double(), random_double()));
+        if (dot(direction, normal) <= 0)
+            return;
+
+        // Radiance times cos over the density of (emitter, point, side, direction).
+        color power = start.mat->emitted(start.u, start.v, start.p)
+                    * (pi * light->surface_area() * sides / (pick_pdf * emitted));
+        ray r(start.p, direction, random_double());
+        bool through_specular = false;
+        for (int bounce = 0; bounce < max_bounces; bounce++) {
+            hit_record rec;
+            if (!world.hit(r, interval(0.001, infinity), rec))
+                return;
+            if (rec.mat->is_diffuse()) {
+                if (through_specular) {
+                    auto d = unit_vector(r.direction());
+                    out.push_back({ { float(rec.p.x()), float(rec.p.y()), float(rec.p.z()) },
+                                    { float(power.x()), float(power.y()), float(power.z()) },
+                                    { float(d.x()), float(d.y()), float(d.z()) } });
+                }
+                return;
+            }
+            color attenuation;
+            ray scattered;
+            if (!rec.mat->scatter(r, rec, attenuation, scattered))
+                return;
+            power = power * attenuation;
+            through_specular = true;
+            r = scattered;
+        }
+    }
+
+    void build(size_t lo, size_t hi) {
+        if (hi - lo <= 1) {
+            if (hi > lo) axes[lo] = 0;
+            return;
+        }
+        float low[3] = { photons[lo].position[0], photons[lo].position[1], photons[lo].position[2] };
+        float high[3] = { low[0], low[1], low[2] };
+        for (size_t k = lo + 1; k < hi; k++)
+            for (int a = 0; a < 3; a++) {
+                low[a] = std::min(low[a], photons[k].position[a]);
+                high[a] = std::max(high[a], photons[k].position[a]);
+            }
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (high[a] - low[a] > high[axis] - low[axis]) axis = a;
+
+        size_t mid = lo + (hi - lo) / 2;
+        std::nth_element(photons.begin() + lo, photons.begin() + mid, photons.begin() + hi,
+            [axis](const photon& a, const photon& b) { return a.position[axis] < b.position[axis]; });
+        axes[mid] = static_cast<unsigned char>(axis);
+
+        if (hi - lo > 8192)
+            tbb::parallel_invoke([&] { build(lo, mid); }, [&] { build(mid + 1, hi); });
+        else {
+            build(lo, mid);
+            build(mid + 1, hi);
+        }
+    }
+
+    template <typename F>
+    void gather(size_t lo, size_t hi, const point3& p, double r2, F&& f) const {
+        // Calls f on every photon within sqrt(r2) of p.
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            const auto& ph = photons[mid];
+            double dx = p.x() - ph.position[0], dy = p.y() - ph.position[1], dz = p.z() - ph.position[2];
+            if (dx*dx + dy*dy + dz*dz <= r2)
+                f(ph);
+
+            int axis = axes[mid];
+            double d = p[axis] - ph.position[axis];
+            size_t near_lo = d < 0 ? lo : mid + 1, near_hi = d < 0 ? mid : hi;
+            size_t far_lo = d < 0 ? mid + 1 : lo, far_hi = d < 0 ? hi : mid;
+            if (d * d <= r2)
+                gather(far_lo, far_hi, p, r2, f);
+            lo = near_lo;
+            hi = near_hi;
+        }
+    }
+};
+
+#endif
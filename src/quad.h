@@ -3,6 +3,8 @@
 
 #include "constUtilFuncs.h"
 #include "hittable.h"
+#include "material.h"
+#include "sampler.h"
 
 class quad : public hittable {
   public:
@@ -13,6 +15,7 @@ class quad : public hittable {
         normal = unit_vector(n);
         D = dot(normal, Q);
         w = n / dot(n,n);
+        area = n.length();
 
         set_bounding_box();
     }
@@ -24,6 +27,7 @@ class quad : public hittable {
     aabb bounding_box() const override { return bbox; }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        RT_STAT(thread_stats().primitive_tests++);
         auto denom = dot(normal, r.direction());
 
         // No hit if the ray is parallel to the plane.
@@ -50,16 +54,81 @@ class quad : public hittable {
         rec.t = t;
         rec.p = intersection;
         rec.mat = mat;
+        rec.object = this;
         rec.set_face_normal(r, normal);
 
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        RT_STAT(thread_stats().primitive_tests++);
+        auto denom = dot(normal, r.direction());
+        if (fabs(denom) < 1e-8)
+            return false;
+
+        auto t = (D - dot(normal, r.origin())) / denom;
+        if (!ray_t.contains(t))
+            return false;
+
+        vec3 planar_hitpt_vector = r.at(t) - Q;
+        return is_inside(dot(w, cross(planar_hitpt_vector, v)), dot(w, cross(u, planar_hitpt_vector)));
+    }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        hit_record rec;
+        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+            return 0;
+
+        auto distance_squared = rec.t * rec.t * direction.length_squared();
+        auto cosine = fabs(dot(direction, rec.normal) / direction.length());
+        return distance_squared / (cosine * area);
+    }
+
+    vec3 random(const point3& origin) const override {
+        double s, t;
+        sample_2d(s, t);
+        auto p = Q + (s * u) + (t * v);
+        return p - origin;
+    }
+
+    double surface_area() const override { return area; }
+
+    void sample_surface(double s, double t, hit_record& rec) const override {
+        rec.p = Q + (s * u) + (t * v);
+        rec.normal = normal;
+        rec.front_face = true;
+        rec.u = s;
+        rec.v = t;
+        rec.mat = mat;
+        rec.object = this;
+    }
+
+    void collect_emitters(std::vector<const hittable*>& emitters) const override {
+        if (mat && mat->is_emissive())
+            emitters.push_back(this);
+    }
+
+    emitter_bounds emission_bounds() const override {
+        // diffuse_light emits from both faces.
+        emitter_bounds e;
+        auto radiance = mat->emitted(0.5, 0.5, Q + 0.5*(u + v));
+        e.bounds = bbox;
+        e.axis = normal;
+        e.power = (radiance.x() + radiance.y() + radiance.z()) / 3 * 2*area * pi;
+        e.two_sided = true;
+        return e;
+    }
+
+    virtual bool is_inside(double a, double b) const {
+        // Given the hit point in plane coordinates, return whether it lies on the primitive.
+        return !((a < 0) || (1 < a) || (b < 0) || (1 < b));
+    }
+
     virtual bool is_interior(double a, double b, hit_record& rec) const {
         // Given the hit point in plane coordinates, return false if it is outside the
         // primitive, otherwise set the hit record UV coordinates and return true.
 
-        if ((a < 0) || (1 < a) || (b < 0) || (1 < b))
+        if (!is_inside(a, b))
             return false;
 
         rec.u = a;
@@ -75,6 +144,7 @@ class quad : public hittable {
     vec3 normal;
     double D;
     vec3 w;
+    double area;
 };
 
 #endif
\ No newline at end of file
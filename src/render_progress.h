@@ -0,0 +1,175 @@
+#ifndef RENDER_PROGRESS_H
+#define RENDER_PROGRESS_H
+
+// Render progress and live telemetry.
+//
+// Worker threads only bump relaxed atomic counters when they finish a row; a separate reporter
+// thread samples them a few times a second and does all the formatting and I/O: a progress line
+// on std::clog (progress, ETA, rays/s, mean thread utilization) and, if requested, a JSON status
+// file for schedulers to poll. The file is written to <path>.tmp and renamed over <path>, so a
+// reader never sees it half written.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tbb/task_arena.h>
+
+class render_progress {
+public:
+    int interval_ms = 250;  // Time between reports
+
+    render_progress() = default;
+    ~render_progress() { finish(); }
+
+    // Copies (of a camera, say) only take the settings; counters and the reporter start fresh.
+    render_progress(const render_progress& other) : interval_ms(other.interval_ms) {}
+    render_progress& operator=(const render_progress& other) {
+        interval_ms = other.interval_ms;
+        return *this;
+    }
+
+    void start(int total_rows, bool show_bar, const std::string& status_path) {
+        finish();
+        rows_total = total_rows;
+        show = show_bar;
+        status_file = status_path;
+        rows_done = 0;
+        rays = 0;
+
+        thread_count = std::max(1, tbb::this_task_arena::max_concurrency());
+        busy_ns.reset(new slot[thread_count]);
+        begin = std::chrono::steady_clock::now();
+
+        if (!show && status_file.empty())
+            return;
+        stopping = false;
+        reporter = std::thread([this] { report_loop(); });
+    }
+
+    // Called by worker threads; neither blocks.
+    void add_busy_time(std::chrono::steady_clock::duration busy) {
+        int t = tbb::this_task_arena::current_thread_index();
+        if (t >= 0 && t < thread_count)
+            busy_ns[t].value.fetch_add(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count(),
+                std::memory_order_relaxed);
+    }
+
+    void row_done(uint64_t row_rays) {
+        rays.fetch_add(row_rays, std::memory_order_relaxed);
+        rows_done.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void add_rows(int rows) {
+        // Grows (or shrinks) the row total, for renders that plan their passes as they go.
+        rows_total.fetch_add(rows, std::memory_order_relaxed);
+    }
+
+    void finish() {
+        // Stops the reporter after a last report. Safe to call more than once.
+        if (!reporter.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_one();
+        reporter.join();
+    }
+
+    uint64_t rays_traced() const { return rays.load(); }
+
+private:
+    struct alignas(64) slot {
+        std::atomic<uint64_t> value{0};  // One per cache line so threads do not share lines
+    };
+
+    std::atomic<int> rows_total{0};
+    bool show = false;
+    std::string status_file;
+    std::atomic<int> rows_done{0};
+    std::atomic<uint64_t> rays{0};
+    int thread_count = 0;
+    std::unique_ptr<slot[]> busy_ns;
+    std::chrono::steady_clock::time_point begin;
+
+    std::thread reporter;
+    std::mutex mtx;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void report_loop() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!wake.wait_for(lock, std::chrono::milliseconds(interval_ms), [this] { return stopping; }))
+            report(false);
+        report(true);
+    }
+
+    void report(bool done) {
+        const int bar_width = 50;
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        double seconds = std::max(elapsed.count(), 1e-9);
+        int rows = rows_done.load(std::memory_order_relaxed);
+        int total = rows_total.load(std::memory_order_relaxed);
+        uint64_t ray_total = rays.load(std::memory_order_relaxed);
+        double fraction = total > 0 ? double(rows) / total : 1.0;
+        double eta = rows > 0 ? seconds * (total - rows) / rows : -1.0;
+        double rays_per_s = ray_total / seconds;
+
+        double total_utilization = 0;
+        std::vector<double> utilization(thread_count);
+        for (int t = 0; t < thread_count; t++) {
+            utilization[t] = std::min(1.0, busy_ns[t].value.load(std::memory_order_relaxed) * 1e-9 / seconds);
+            total_utilization += utilization[t];
+        }
+
+        if (show) {
+            std::ostringstream line;
+            int filled_width = static_cast<int>(fraction * bar_width);
+            line << "\r[" << std::string(filled_width, '=') << std::string(bar_width - filled_width, ' ')
+                 << "] " << std::fixed << std::setprecision(2) << fraction * 100.0 << "%"
+                 << std::setprecision(1) << "  ETA " << (eta >= 0 ? eta : 0.0) << "s  "
+                 << rays_per_s * 1e-6 << " Mrays/s  util "
+                 << std::setprecision(0) << 100.0 * total_utilization / thread_count << "%   ";
+            if (done)
+                line << "\rDone in " << std::setprecision(2) << seconds << "s, "
+                     << rays_per_s * 1e-6 << " Mrays/s" << std::string(bar_width + 30, ' ') << '\n';
+            std::clog << line.str();
+            std::clog.flush();
+        }
+
+        if (!status_file.empty()) {
+            std::ostringstream json;
+            json << "{\"state\": \"" << (done ? "done" : "rendering") << "\""
+                 << ", \"rows_done\": " << rows << ", \"rows_total\": " << total
+                 << ", \"progress\": " << fraction << ", \"elapsed_s\": " << seconds
+                 << ", \"eta_s\": " << (done ? 0.0 : eta) << ", \"rays\": " << ray_total
+                 << ", \"rays_per_s\": " << rays_per_s << ", \"thread_utilization\": [";
+            for (int t = 0; t < thread_count; t++)
+                json << (t ? ", " : "") << utilization[t];
+            json << "]}\n";
+
+            auto tmp = status_file + ".tmp";
+            {
+                std::ofstream out(tmp);
+                out << json.str();
+            }
+            std::rename(tmp.c_str(), status_file.c_str());
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "constUtilFuncs.h"
+
+#include "camera.h"
+#include "distributed.h"
+#include "hittable_list.h"
+#include "scenes.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Long-running render server.
+//
+// Scenes (including their decoded textures and BVH) are built on first use and then kept for
+// the life of the process, as is the TBB worker pool, so a job only pays for tracing its rays.
+// So are the light BVH, path guide and photon map made for a job: the last max_prepared
+// cameras are kept per scene and settings that change pixels, and a repeated job reuses them.
+// Jobs arrive one per line, either on stdin (`--server`) or on a Unix socket
+// (`--server-socket <path>`, one connection served at a time):
+//
+//     render id=<job> scene=<n> size=<objects> width=<px> spp=<n> depth=<n> seed=<n> vfov=<deg>
+//            lookfrom=x,y,z lookat=x,y,z vup=x,y,z aspect=<w/h> crop=x0,y0,x1,y1
+//            sampler=independent|sobol|stratified|blue_noise lights=0|1 guiding=<passes>
+//            caustics=<photons> caustic_radius=<r>
+//            threads=<n> numa=<node> pin=0|1
+//     preload scene=<n> [size=<objects>] [seed=<n>]
+//     quit
+//
+// Every key is optional and defaults to the camera the server was started with. The crop
+// rectangle is in pixels of the full image, end-exclusive; guiding=0 turns path guiding off and
+// caustics=0 photon mapping (jobs use one photon map, as tiles do). A job with threads, numa or
+// pin set runs in a task arena of its own (see execution_context.h).
+// Each render is answered with
+//
+//     ok <id> <crop width> <crop height> <render ms> <byte count>\n<PPM image of the crop>
+//
+// and failures with `error <id> <message>\n`.
+
+class render_server {
+public:
+    render_server(const camera& base) : base_camera(base) {
+        base_camera.show_progress = false;
+    }
+
+    int serve(int in_fd, int out_fd) {
+        // Serves jobs from in_fd until it closes or a quit command arrives. Returns 0 on quit.
+        std::string line;
+        std::string inbox;
+        char buffer[4096];
+
+        while (true) {
+            auto eol = inbox.find('\n');
+            if (eol == std::string::npos) {
+                auto n = read(in_fd, buffer, sizeof(buffer));
+                if (n <= 0) return 1;
+                inbox.append(buffer, n);
+                continue;
+            }
+            line = inbox.substr(0, eol);
+            inbox.erase(0, eol + 1);
+
+            std::istringstream msg(line);
+            std::string command;
+            msg >> command;
+            if (command.empty()) continue;
+            if (command == "quit") return 0;
+
+            auto reply = handle(command, msg);
+            if (!distributed_detail::write_line(out_fd, reply)) return 1;
+        }
+    }
+
+    int listen_on(const std::string& path) {
+        // Accepts connections on a Unix socket and serves them one after another. A quit on any
+        // connection stops the server.
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (listener < 0 || path.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "ERROR: Could not create socket '" << path << "'.\n";
+            return 1;
+        }
+        std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+        unlink(path.c_str());
+        if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+            || listen(listener, 8) != 0) {
+            std::cerr << "ERROR: Could not listen on '" << path << "'.\n";
+            close(listener);
+            return 1;
+        }
+
+        signal(SIGPIPE, SIG_IGN); // A client that hangs up must not take the server down
+        std::clog << "Render server listening on " << path << '\n';
+        int status = 1;
+        while (status != 0) {
+            int client = accept(listener, nullptr, nullptr);
+            if (client < 0) continue;
+            status = serve(client, client);
+            close(client);
+        }
+        close(listener);
+        unlink(path.c_str());
+        return 0;
+    }
+
+private:
+    camera base_camera;
+    std::map<std::tuple<int, size_t, uint64_t>, std::shared_ptr<hittable_list>> scenes;
+
+    struct prepared_camera {
+        std::unique_ptr<camera> cam;
+        const hittable* world = nullptr;
+        uint64_t last_used = 0;
+    };
+    static const size_t max_prepared = 16;
+    std::map<std::string, prepared_camera> prepared;  // By scene, size and camera_description()
+    uint64_t jobs = 0;
+
+    const hittable_list& scene(int id, size_t size, uint64_t seed) {
+        // Built once per (scene, size, seed) and kept resident. Size only matters for the
+        // procedural stress scenes.
+        auto& slot = scenes[{id, size, seed}];
+        if (!slot) {
+            auto start = std::chrono::steady_clock::now();
+            seed_random(seed);
+            slot = std::make_shared<hittable_list>(build_scene(id, size));
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::clog << "Loaded scene " << id << " in " << elapsed.count() << " ms\n";
+        }
+        return *slot;
+    }
+
+    camera& prepared_for(int id, size_t size, const hittable_list& world, const camera& settings) {
+        // A camera with these settings, prepared for world. A new one borrows the light BVH (and
+        // a matching photon map) of another camera on the same world, and evicts the least
+        // recently used camera past max_prepared.
+        auto& entry = prepared[std::to_string(id) + ' ' + std::to_string(size) + ' ' + camera_description(settings)];
+        entry.last_used = ++jobs;
+        if (!entry.cam) {
+            entry.cam = std::make_unique<camera>(settings);
+            entry.world = &world;
+            const camera* donor = nullptr;
+            auto oldest = prepared.end();
+            for (auto it = prepared.begin(); it != prepared.end(); ++it) {
+                if (it->second.cam.get() == entry.cam.get()) continue;
+                if (it->second.world == &world) donor = it->second.cam.get();
+                if (oldest == prepared.end() || it->second.last_used < oldest->second.last_used) oldest = it;
+            }
+            run_in_context(settings.execution, [&] { entry.cam->prepare(world, donor); });
+            if (prepared.size() > max_prepared)
+                prepared.erase(oldest);
+        }
+        entry.cam->execution = settings.execution;
+        return *entry.cam;
+    }
+
+    static bool parse_vec(const std::string& text, vec3& v) {
+        return std::sscanf(text.c_str(), "%lf,%lf,%lf", &v[0], &v[1], &v[2]) == 3;
+    }
+
+    std::string handle(const std::string& command, std::istringstream& msg) {
+        auto cam = base_camera;
+        int scene_id = 7;
+        size_t scene_size = 0;
+        std::string id = "-";
+        int crop[4] = { 0, 0, -1, -1 };
+        bool ok = true;
+
+        std::string token;
+        while (msg >> token) {
+            auto eq = token.find('=');
+            auto key = token.substr(0, eq);
+            auto value = (eq == std::string::npos) ? std::string() : token.substr(eq + 1);
+            try {
+                if (key == "id")            id = value;
+                else if (key == "scene")    scene_id = std::stoi(value);
+                else if (key == "size")     scene_size = std::stoull(value);
+                else if (key == "width")    cam.image_width = std::stoi(value);
+                else if (key == "aspect")   cam.aspect_ratio = std::stod(value);
+                else if (key == "spp")      cam.samples_per_pixel = std::stoi(value);
+                else if (key == "depth")    cam.max_depth = std::stoi(value);
+                else if (key == "seed")     cam.seed = std::stoull(value);
+                else if (key == "vfov")     cam.vfov = std::stod(value);
+                else if (key == "defocus")  cam.defocus_angle = std::stod(value);
+                else if (key == "focus")    cam.focus_dist = std::stod(value);
+                else if (key == "lookfrom") ok = parse_vec(value, cam.lookfrom);
+                else if (key == "lookat")   ok = parse_vec(value, cam.lookat);
+                else if (key == "vup")      ok = parse_vec(value, cam.vup);
+                else if (key == "background") ok = parse_vec(value, cam.background);
+                else if (key == "sampler")  ok = sampler_type_from_name(value, cam.sampling);
+                else if (key == "lights")   cam.sample_lights = std::stoi(value) != 0;
+                else if (key == "guiding") {
+                    cam.guiding_passes = std::stoi(value);
+                    cam.path_guiding = cam.guiding_passes > 0;
+                }
+                else if (key == "caustics") cam.caustic_photons = std::stoi(value);
+                else if (key == "caustic_radius") cam.caustic_radius = std::stod(value);
+                else if (key == "threads")  cam.execution.threads = std::stoi(value);
+                else if (key == "numa") {
+                    cam.execution.numa_node = std::stoi(value);
+                    ok = numa_node_exists(cam.execution.numa_node);
+                }
+                else if (key == "pin")      cam.execution.pin_threads = std::stoi(value) != 0;
+                else if (key == "crop")
+                    ok = std::sscanf(value.c_str(), "%d,%d,%d,%d", &crop[0], &crop[1], &crop[2], &crop[3]) == 4;
+                else ok = false;
+            } catch (...) {
+                ok = false;
+            }
+            if (!ok) return "error " + id + " bad argument '" + token + "'\n";
+        }
+
+        if (scene_id < 1 || scene_id > scene_count())
+            return "error " + id + " unknown scene\n";
+        if (command == "preload") {
+            scene(scene_id, scene_size, cam.seed);
+            return "ok " + id + "\n";
+        }
+        if (command != "render")
+            return "error " + id + " unknown command '" + command + "'\n";
+
+        int width = cam.image_width, height = cam.height();
+        if (crop[2] < 0) { crop[2] = width; crop[3] = height; }
+        if (crop[0] < 0 || crop[1] < 0 || crop[2] > width || crop[3] > height
+            || crop[0] >= crop[2] || crop[1] >= crop[3])
+            return "error " + id + " crop outside the image\n";
+
+        const auto& world = scene(scene_id, scene_size, cam.seed);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<color> pixels;
+        uint64_t rays;
+        prepared_for(scene_id, scene_size, world, cam).render_tile(world, crop[0], crop[1], crop[2], crop[3],
+                                                                   pixels, rays);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::ostringstream image;
+        int crop_width = crop[2] - crop[0], crop_height = crop[3] - crop[1];
+        image << "P3\n" << crop_width << ' ' << crop_height << "\n255\n";
+        for (const auto& pixel : pixels)
+            write_color(image, pixel, cam.samples_per_pixel);
+        auto body = image.str();
+
+        std::ostringstream reply;
+        reply << "ok " << id << ' ' << crop_width << ' ' << crop_height << ' '
+              << elapsed.count() << ' ' << body.size() << '\n' << body;
+        return reply.str();
+    }
+};
+
+#endif
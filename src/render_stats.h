@@ -0,0 +1,151 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+// Optional per-render ray and traversal statistics.
+//
+// Counting is compiled in only when RT_STATS is defined (configure with -DRT_ENABLE_STATS=ON);
+// otherwise every RT_STAT(...) expands to nothing and the hot paths are unchanged. Each thread
+// bumps its own counters without synchronization, and the camera merges them once the render
+// is done.
+
+#ifdef RT_STATS
+    #define RT_STAT(expr) (expr)
+#else
+    #define RT_STAT(expr) ((void)0)
+#endif
+
+#ifdef RT_STATS
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class render_stats {
+public:
+    static const int max_tracked_depth = 64; // Deeper bounces are counted in the last bucket
+
+    uint64_t rays_per_depth[max_tracked_depth] = {}; // Index 0 holds camera rays
+    uint64_t bvh_nodes_visited = 0;
+    uint64_t primitive_tests   = 0;
+    uint64_t shadow_rays       = 0;
+    uint64_t paths_escaped     = 0; // Terminated by missing the scene
+    uint64_t paths_absorbed    = 0; // Terminated by a material that does not scatter
+    uint64_t paths_max_depth   = 0; // Terminated by the bounce limit
+
+    void count_ray(int bounce) {
+        rays_per_depth[std::min(bounce, max_tracked_depth - 1)]++;
+    }
+
+    uint64_t traversal_cost() const { return bvh_nodes_visited + primitive_tests; }
+
+    void merge(const render_stats& other) {
+        for (int i = 0; i < max_tracked_depth; i++)
+            rays_per_depth[i] += other.rays_per_depth[i];
+        bvh_nodes_visited += other.bvh_nodes_visited;
+        primitive_tests   += other.primitive_tests;
+        shadow_rays       += other.shadow_rays;
+        paths_escaped     += other.paths_escaped;
+        paths_absorbed    += other.paths_absorbed;
+        paths_max_depth   += other.paths_max_depth;
+    }
+
+    void print(std::ostream& out) const {
+        uint64_t total_rays = 0;
+        for (auto n : rays_per_depth) total_rays += n;
+
+        out << "Ray statistics:\n"
+            << "  rays traced:        " << total_rays << '\n';
+        for (int i = 0; i < max_tracked_depth; i++)
+            if (rays_per_depth[i] > 0)
+                out << "    depth " << i << ":" << std::string(i < 10 ? 10 : 9, ' ')
+                    << rays_per_depth[i] << '\n';
+        out << "  shadow rays:        " << shadow_rays << '\n'
+            << "  BVH nodes visited:  " << bvh_nodes_visited << '\n'
+            << "  primitive tests:    " << primitive_tests << '\n'
+            << "  paths escaped:      " << paths_escaped << '\n'
+            << "  paths absorbed:     " << paths_absorbed << '\n'
+            << "  paths at max depth: " << paths_max_depth << '\n';
+        if (total_rays > 0)
+            out << "  nodes per ray:      " << double(bvh_nodes_visited) / total_rays << '\n'
+                << "  tests per ray:      " << double(primitive_tests) / total_rays << '\n';
+    }
+};
+
+class render_stats_registry {
+public:
+    static render_stats_registry& instance() {
+        static render_stats_registry registry;
+        return registry;
+    }
+
+    render_stats& local() {
+        // Counters are owned by the registry so they outlive the worker thread that filled them.
+        thread_local render_stats* stats = nullptr;
+        if (!stats) {
+            std::lock_guard<std::mutex> lock(mtx);
+            all.push_back(std::make_unique<render_stats>());
+            stats = all.back().get();
+        }
+        return *stats;
+    }
+
+    render_stats collect() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        render_stats total;
+        for (const auto& s : all) total.merge(*s);
+        return total;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& s : all) *s = render_stats();
+    }
+
+private:
+    mutable std::mutex mtx;
+    std::vector<std::unique_ptr<render_stats>> all;
+};
+
+inline render_stats& thread_stats() {
+    return render_stats_registry::instance().local();
+}
+
+inline void write_heatmap(const std::string& filename, const std::vector<float>& values,
+                          int width, int height) {
+    // Writes `values` (row-major, one per pixel) as a false-color PPM. The scale saturates at
+    // the 99th percentile so a handful of pathological pixels do not wash out the image.
+    std::vector<float> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    float scale_max = sorted.empty() ? 0.0f : sorted[(sorted.size() - 1) * 99 / 100];
+    if (scale_max <= 0.0f) scale_max = 1.0f;
+
+    std::ofstream out(filename);
+    if (!out) {
+        std::cerr << "ERROR: Could not write heatmap '" << filename << "'.\n";
+        return;
+    }
+
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    for (auto value : values) {
+        // Black -> blue -> cyan -> yellow -> red -> white.
+        static const float ramp[6][3] = {
+            {0,0,0}, {0,0,1}, {0,1,1}, {1,1,0}, {1,0,0}, {1,1,1}
+        };
+        float x = std::min(value / scale_max, 1.0f) * 5.0f;
+        int k = std::min(static_cast<int>(x), 4);
+        float f = x - k;
+        for (int c = 0; c < 3; c++) {
+            auto channel = ramp[k][c] + f * (ramp[k+1][c] - ramp[k][c]);
+            out << static_cast<int>(255.999f * channel) << (c < 2 ? ' ' : '\n');
+        }
+    }
+}
+
+#endif // RT_STATS
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef RENDER_TRACE_H
+#define RENDER_TRACE_H
+
+// Optional phase timeline and hardware counter tracing.
+//
+// Compiled in only when RT_TRACE is defined (configure with -DRT_ENABLE_TRACE=ON); otherwise
+// every RT_TRACE_SCOPE(...) expands to nothing. A scope records one event on the calling thread:
+// its wall-clock span and, on Linux, what perf_event_open counters for that thread (cycles,
+// instructions, cache misses, branch misses, task clock, page faults) advanced by inside it.
+// Phases (scene build, BVH build, light/photon/guide preparation, render, output) are scoped in
+// main and camera, and so is every row or tile, which shows each worker's share of the render.
+//
+// write_chrome_trace() exports the events in Chrome's trace-event format (load the file in
+// chrome://tracing or ui.perfetto.dev), with the counter deltas as each event's arguments;
+// print_summary() totals them per phase and per thread. Counters the kernel refuses (no PMU in
+// a VM, perf_event_paranoid too strict) are left out, and the timeline still works.
+
+#ifdef RT_TRACE
+    #define RT_TRACE_CONCAT_(a, b) a##b
+    #define RT_TRACE_CONCAT(a, b) RT_TRACE_CONCAT_(a, b)
+    #define RT_TRACE_SCOPE(category, name) \
+        trace_scope RT_TRACE_CONCAT(rt_trace_scope_, __LINE__)(category, name)
+    #define RT_TRACE_SCOPE_INDEX(category, name, index) \
+        trace_scope RT_TRACE_CONCAT(rt_trace_scope_, __LINE__)(category, name, index)
+#else
+    #define RT_TRACE_SCOPE(category, name) ((void)0)
+    #define RT_TRACE_SCOPE_INDEX(category, name, index) ((void)0)
+#endif
+
+#ifdef RT_TRACE
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class perf_counters {
+public:
+    static const int count = 6;
+
+    static const char* name(int k) {
+        static const char* names[count] = {
+            "cycles", "instructions", "cache_misses", "branch_misses", "task_clock_ns", "page_faults"
+        };
+        return names[k];
+    }
+
+    perf_counters() {
+        // Counts this thread in user space, on whatever CPU it runs.
+#ifdef __linux__
+        static const uint32_t types[count] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+            PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE
+        };
+        static const uint64_t configs[count] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_SW_PAGE_FAULTS
+        };
+        for (int k = 0; k < count; k++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[k];
+            attr.config = configs[k];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[k] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~perf_counters() {
+#ifdef __linux__
+        for (int fd : fds)
+            if (fd >= 0) close(fd);
+#endif
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    bool available(int k) const { return fds[k] >= 0; }
+
+    void read_all(uint64_t (&values)[count]) const {
+        for (int k = 0; k < count; k++) {
+            values[k] = 0;
+#ifdef __linux__
+            if (fds[k] >= 0 && ::read(fds[k], &values[k], sizeof(values[k])) != sizeof(values[k]))
+                values[k] = 0;
+#endif
+        }
+    }
+
+    static perf_counters& local() {
+        thread_local perf_counters counters;
+        return counters;
+    }
+
+private:
+    int fds[count] = { -1, -1, -1, -1, -1, -1 };
+};
+
+struct trace_event {
+    const char* category;
+    const char* name;
+    int64_t index;        // Row or tile number, or -1
+    double start_us;      // Since the recorder started
+    double duration_us;
+    int depth;            // Scopes open on the thread around this one
+    uint64_t counters[perf_counters::count];
+};
+
+class trace_recorder {
+public:
+    struct thread_log {
+        int id;
+        std::vector<trace_event> events;
+        int depth = 0;
+        bool counted[perf_counters::count] = {};
+    };
+
+    static trace_recorder& instance() {
+        static trace_recorder recorder;
+        return recorder;
+    }
+
+    thread_log& local() {
+        // Logs are owned by the recorder so they outlive the worker thread that filled them.
+        thread_local thread_log* log = nullptr;
+        if (!log) {
+            std::lock_guard<std::mutex> lock(mtx);
+            logs.push_back(std::make_unique<thread_log>());
+            log = logs.back().get();
+            log->id = int(logs.size()) - 1;
+            auto& counters = perf_counters::local();
+            for (int k = 0; k < perf_counters::count; k++)
+                log->counted[k] = counters.available(k);
+        }
+        return *log;
+    }
+
+    double now_us() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void write_chrome_trace(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) {
+            std::cerr << "ERROR: Could not write trace '" << path << "'.\n";
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (const auto& log : logs) {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << log->id
+                << ",\"args\":{\"name\":\"" << (log->id == 0 ? "main" : "worker " + std::to_string(log->id)) << "\"}}";
+            first = false;
+            for (const auto& e : log->events) {
+                out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":1"
+                    << ",\"tid\":" << log->id << std::fixed << std::setprecision(3) << ",\"ts\":" << e.start_us
+                    << ",\"dur\":" << e.duration_us << std::defaultfloat << ",\"args\":{";
+                bool first_arg = true;
+                auto arg = [&](const char* key, auto value) {
+                    out << (first_arg ? "" : ",") << '"' << key << "\":" << value;
+                    first_arg = false;
+                };
+                if (e.index >= 0) arg("index", e.index);
+                for (int k = 0; k < perf_counters::count; k++)
+                    if (log->counted[k]) arg(perf_counters::name(k), e.counters[k]);
+                if (log->counted[0] && log->counted[1] && e.counters[0] > 0)
+                    arg("ipc", double(e.counters[1]) / e.counters[0]);
+                out << "}}";
+            }
+        }
+        out << "\n]}\n";
+    }
+
+    void print_summary(std::ostream& out) const {
+        // Totals per event name, then per thread over its outermost events (nested ones are
+        // already inside those).
+        struct total {
+            size_t events = 0;
+            double ms = 0;
+            uint64_t counters[perf_counters::count] = {};
+            void add(const trace_event& e) {
+                events++;
+                ms += e.duration_us / 1000;
+                for (int k = 0; k < perf_counters::count; k++) counters[k] += e.counters[k];
+            }
+        };
+        std::lock_guard<std::mutex> lock(mtx);
+        std::map<std::string, total> phases;
+        std::vector<total> threads(logs.size());
+        bool counted[perf_counters::count] = {};
+        for (const auto& log : logs) {
+            for (int k = 0; k < perf_counters::count; k++) counted[k] = counted[k] || log->counted[k];
+            for (const auto& e : log->events) {
+                phases[std::string(e.category) + ": " + e.name].add(e);
+                if (e.depth == 0) threads[log->id].add(e);
+            }
+        }
+
+        auto line = [&](const std::string& label, const total& t) {
+            out << "  " << std::left << std::setw(28) << label << std::right << std::setw(6) << t.events
+                << std::fixed << std::setprecision(1) << std::setw(10) << t.ms << " ms" << std::defaultfloat;
+            for (int k = 0; k < perf_counters::count; k++)
+                if (counted[k]) out << "  " << perf_counters::name(k) << ' ' << t.counters[k];
+            if (counted[0] && counted[1] && t.counters[0] > 0)
+                out << "  ipc " << std::setprecision(3) << double(t.counters[1]) / t.counters[0];
+            out << '\n';
+        };
+        out << "Trace summary (events, wall time" << (counted[0] ? ", counters" : "; no hardware counters") << "):\n";
+        for (const auto& [label, t] : phases)
+            line(label, t);
+        for (size_t k = 0; k < threads.size(); k++)
+            if (threads[k].events)
+                line(k == 0 ? "thread main" : "thread worker " + std::to_string(k), threads[k]);
+    }
+
+private:
+    trace_recorder() : epoch(std::chrono::steady_clock::now()) {}
+
+    std::chrono::steady_clock::time_point epoch;
+    mutable std::mutex mtx;
+    std::vector<std::unique_ptr<thread_log>> logs;
+};
+
+class trace_scope {
+public:
+    trace_scope(const char* category, const char* name, int64_t index = -1)
+      : log(trace_recorder::instance().local())
+    {
+        event.category = category;
+        event.name = name;
+        event.index = index;
+        event.depth = log.depth++;
+        perf_counters::local().read_all(event.counters);
+        event.start_us = trace_recorder::instance().now_us();
+    }
+
+    ~trace_scope() {
+        event.duration_us = trace_recorder::instance().now_us() - event.start_us;
+        uint64_t end[perf_counters::count];
+        perf_counters::local().read_all(end);
+        for (int k = 0; k < perf_counters::count; k++)
+            event.counters[k] = end[k] - event.counters[k];
+        log.depth--;
+        log.events.push_back(event);
+    }
+
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+
+private:
+    trace_recorder::thread_log& log;
+    trace_event event;
+};
+
+#endif // RT_TRACE
+
+#endif
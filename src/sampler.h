@@ -0,0 +1,414 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "constUtilFuncs.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Sample sequences for camera and scattering decisions.
+//
+// Every random decision along a path draws from a numbered dimension: the camera uses the first
+// camera_dimensions (pixel position, lens, time) and bounce k starts at camera_dimensions +
+// k*bounce_dimensions. A sampler maps (sample index, dimension) to a value in [0,1), so with a
+// low-discrepancy sampler the samples of a pixel stay well spread in every dimension rather than
+// clumping like independent random numbers do.
+//
+// The camera installs a sampler per pixel as the calling thread's current sampler; sample_1d()
+// and sample_2d() draw from it, and fall back to random_double() when none is installed (so
+// materials used outside the camera keep working).
+
+enum class sampler_type {
+    independent,  // Plain random_double() for every dimension
+    sobol,        // Owen-scrambled Sobol, padded per dimension pair (Burley 2020)
+    stratified,   // Correlated multi-jittered (Kensler 2013)
+    blue_noise    // One Sobol sequence for all pixels, offset per pixel by a blue-noise mask
+};
+
+inline bool sampler_type_from_name(const std::string& name, sampler_type& type) {
+    if (name == "independent")     type = sampler_type::independent;
+    else if (name == "sobol")      type = sampler_type::sobol;
+    else if (name == "stratified") type = sampler_type::stratified;
+    else if (name == "blue_noise") type = sampler_type::blue_noise;
+    else return false;
+    return true;
+}
+
+namespace sampler_detail {
+
+inline uint32_t hash(uint32_t x) {
+    // lowbias32 integer hash
+    x ^= x >> 16; x *= 0x7feb352du;
+    x ^= x >> 15; x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+    return hash(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    // Owen scrambling by hashing (Laine-Karras permutation on the bit-reversed value).
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+inline uint32_t sobol_dim0(uint32_t index) { return reverse_bits(index); }
+
+inline uint32_t sobol_dim1(uint32_t index) {
+    // Second Sobol dimension (primitive polynomial x+1): each direction number is the previous
+    // one xor-ed with itself shifted right by one.
+    uint32_t x = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+        if (index & 1) x ^= v;
+    return x;
+}
+
+inline double to_unit(uint32_t x) { return x * (1.0 / 4294967296.0); }
+
+inline uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+    // Hashed permutation of [0,l) (Kensler 2013).
+    uint32_t w = l - 1;
+    w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+    do {
+        i ^= p; i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8; i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1; i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11; i *= 0x74dcb303u;
+        i ^= (i & w) >> 2; i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+inline double jitter(uint32_t i, uint32_t p) {
+    // Hashed value in [0,1) (Kensler 2013).
+    i ^= p;
+    i ^= i >> 17; i ^= i >> 10; i *= 0xb36534e5u;
+    i ^= i >> 12; i ^= i >> 21; i *= 0x93fc4795u;
+    i ^= 0xdf6e307fu; i ^= i >> 17; i *= 1 | p >> 18;
+    return to_unit(i);
+}
+
+class blue_noise_mask {
+    // 64x64 tileable blue-noise ranks, generated once with void-and-cluster (Ulichney 1993).
+public:
+    static const int size = 64;
+
+    static const blue_noise_mask& instance() {
+        static const blue_noise_mask mask;
+        return mask;
+    }
+
+    double at(int x, int y) const { return rank[(y & (size-1))*size + (x & (size-1))]; }
+
+private:
+    std::vector<double> rank;
+
+    blue_noise_mask() : rank(size * size) {
+        const int n = size * size;
+        const double sigma = 1.9;
+
+        // Toroidal Gaussian energy of a point at the origin, indexed by offset.
+        std::vector<double> kernel(n);
+        for (int dy = 0; dy < size; dy++)
+            for (int dx = 0; dx < size; dx++) {
+                int x = std::min(dx, size - dx), y = std::min(dy, size - dy);
+                kernel[dy*size + dx] = exp(-(x*x + y*y) / (2*sigma*sigma));
+            }
+
+        std::vector<char> on(n, 0);
+        std::vector<double> energy(n, 0.0);
+        auto toggle = [&](int p, bool set) {
+            on[p] = set;
+            int px = p % size, py = p / size;
+            double sign = set ? 1.0 : -1.0;
+            for (int y = 0; y < size; y++)
+                for (int x = 0; x < size; x++)
+                    energy[y*size + x] += sign * kernel[((y - py) & (size-1))*size + ((x - px) & (size-1))];
+        };
+        auto tightest_cluster = [&]() {
+            int best = -1;
+            for (int p = 0; p < n; p++)
+                if (on[p] && (best < 0 || energy[p] > energy[best])) best = p;
+            return best;
+        };
+        auto largest_void = [&]() {
+            int best = -1;
+            for (int p = 0; p < n; p++)
+                if (!on[p] && (best < 0 || energy[p] < energy[best])) best = p;
+            return best;
+        };
+
+        // Initial pattern: a tenth of the pixels, relaxed until moving the most clustered point
+        // to the largest void puts it straight back.
+        std::mt19937 generator(1);
+        int ones = 0;
+        while (ones < n / 10) {
+            int p = generator() % n;
+            if (!on[p]) { toggle(p, true); ones++; }
+        }
+        for (int iteration = 0; iteration < n; iteration++) {
+            int cluster = tightest_cluster();
+            toggle(cluster, false);
+            int hole = largest_void();
+            toggle(hole, true);
+            if (hole == cluster) break;
+        }
+
+        // Ranks below the initial count come from peeling clusters off a copy, ranks above from
+        // filling voids.
+        auto initial_on = on;
+        auto initial_energy = energy;
+        for (int r = ones - 1; r >= 0; r--) {
+            int p = tightest_cluster();
+            toggle(p, false);
+            rank[p] = r;
+        }
+        on = initial_on;
+        energy = initial_energy;
+        for (int r = ones; r < n; r++) {
+            int p = largest_void();
+            toggle(p, true);
+            rank[p] = r;
+        }
+        for (auto& r : rank)
+            r = (r + 0.5) / n;
+    }
+};
+
+} // namespace sampler_detail
+
+class sampler {
+public:
+    static const int camera_dimensions = 5;  // Pixel position (2), lens (2), time (1)
+    static const int bounce_dimensions = 5;  // Scatter direction (2), light choice (1), light point (2)
+
+    virtual ~sampler() = default;
+
+    void start_sample(int index) {
+        sample_index = index;
+        dimension = 0;
+    }
+
+    void start_bounce(int bounce) { dimension = bounce_start = camera_dimensions + bounce * bounce_dimensions; }
+
+    double get_1d() { return value_1d(dimension++); }
+
+    void get_2d(double& u, double& v) {
+        value_2d(dimension, u, v);
+        dimension += 2;
+    }
+
+    // The current bounce's scatter direction pair again, for another strategy to sample with.
+    void scatter_2d(double& u, double& v) { value_2d(bounce_start, u, v); }
+
+protected:
+    uint32_t sample_index = 0;
+
+    virtual double value_1d(int dim) = 0;
+    virtual void value_2d(int dim, double& u, double& v) = 0;
+
+private:
+    int dimension = 0;
+    int bounce_start = camera_dimensions;
+};
+
+class independent_sampler : public sampler {
+protected:
+    double value_1d(int) override { return random_double(); }
+
+    void value_2d(int, double& u, double& v) override {
+        u = random_double();
+        v = random_double();
+    }
+};
+
+class sobol_sampler : public sampler {
+public:
+    sobol_sampler(uint32_t pixel_seed) : seed(pixel_seed) {}
+
+protected:
+    double value_1d(int dim) override {
+        using namespace sampler_detail;
+        auto s = hash_combine(seed, dim);
+        auto index = nested_uniform_scramble(sample_index, s);
+        return to_unit(nested_uniform_scramble(sobol_dim0(index), hash_combine(s, 1)));
+    }
+
+    void value_2d(int dim, double& u, double& v) override {
+        // Each dimension pair is the first two Sobol dimensions with its own index shuffle and
+        // scramble, which keeps pairs decorrelated however many bounces a path takes.
+        using namespace sampler_detail;
+        auto s = hash_combine(seed, dim);
+        auto index = nested_uniform_scramble(sample_index, s);
+        u = to_unit(nested_uniform_scramble(sobol_dim0(index), hash_combine(s, 1)));
+        v = to_unit(nested_uniform_scramble(sobol_dim1(index), hash_combine(s, 2)));
+    }
+
+private:
+    uint32_t seed;
+};
+
+class stratified_sampler : public sampler {
+public:
+    stratified_sampler(uint32_t pixel_seed, int samples)
+      : seed(pixel_seed), count(std::max(samples, 1))
+    {
+        columns = std::max(1, static_cast<int>(sqrt(double(count))));
+        rows = (count + columns - 1) / columns;
+    }
+
+protected:
+    double value_1d(int dim) override {
+        using namespace sampler_detail;
+        auto p = hash_combine(seed, dim);
+        auto stratum = permute(sample_index % count, count, p * 0x51633e2du);
+        return (stratum + jitter(sample_index, p * 0xa399d265u)) / count;
+    }
+
+    void value_2d(int dim, double& u, double& v) override {
+        // Correlated multi-jittered: stratified in 2D and in each 1D projection.
+        using namespace sampler_detail;
+        auto p = hash_combine(seed, dim);
+        uint32_t m = columns, n = rows;
+        uint32_t s = permute(sample_index % (m*n), m*n, p * 0x51633e2du);
+        uint32_t sx = permute(s % m, m, p * 0xa511e9b3u);
+        uint32_t sy = permute(s / m, n, p * 0x63d83595u);
+        double jx = jitter(s, p * 0xa399d265u);
+        double jy = jitter(s, p * 0x711ad6a5u);
+        u = std::min((s % m + (sy + jx) / n) / m, 1.0 - 1e-12);
+        v = std::min((s / m + (sx + jy) / m) / n, 1.0 - 1e-12);
+    }
+
+private:
+    uint32_t seed;
+    int count, columns, rows;
+};
+
+class blue_noise_sampler : public sampler {
+public:
+    // All pixels share one scrambled Sobol sequence (seeded by the render seed), shifted per
+    // pixel and dimension by a blue-noise mask value, so neighbouring pixels make different
+    // errors and what noise remains is high-frequency (Georgiev and Fajardo 2016).
+    blue_noise_sampler(int pixel_x, int pixel_y, uint32_t render_seed)
+      : x(pixel_x), y(pixel_y), seed(render_seed), mask(sampler_detail::blue_noise_mask::instance()) {}
+
+protected:
+    double value_1d(int dim) override {
+        using namespace sampler_detail;
+        auto s = hash_combine(seed, dim);
+        auto index = nested_uniform_scramble(sample_index, s);
+        return wrap(to_unit(nested_uniform_scramble(sobol_dim0(index), hash_combine(s, 1))) + offset(dim));
+    }
+
+    void value_2d(int dim, double& u, double& v) override {
+        using namespace sampler_detail;
+        auto s = hash_combine(seed, dim);
+        auto index = nested_uniform_scramble(sample_index, s);
+        u = wrap(to_unit(nested_uniform_scramble(sobol_dim0(index), hash_combine(s, 1))) + offset(dim));
+        v = wrap(to_unit(nested_uniform_scramble(sobol_dim1(index), hash_combine(s, 2))) + offset(dim + 1));
+    }
+
+private:
+    int x, y;
+    uint32_t seed;
+    const sampler_detail::blue_noise_mask& mask;
+
+    double offset(int dim) const {
+        // A different toroidal shift of the mask per dimension keeps dimensions uncorrelated.
+        auto h = sampler_detail::hash_combine(seed ^ 0x5bd1e995u, dim);
+        return mask.at(x + int(h & 63), y + int((h >> 6) & 63));
+    }
+
+    static double wrap(double t) { return t >= 1.0 ? t - 1.0 : t; }
+};
+
+inline std::unique_ptr<sampler> make_sampler(sampler_type type, int i, int j, uint32_t pixel_seed,
+                                             uint32_t render_seed, int samples) {
+    switch (type) {
+        case sampler_type::sobol:      return std::make_unique<sobol_sampler>(pixel_seed);
+        case sampler_type::stratified: return std::make_unique<stratified_sampler>(pixel_seed, samples);
+        case sampler_type::blue_noise: return std::make_unique<blue_noise_sampler>(i, j, render_seed);
+        default:                       return std::make_unique<independent_sampler>();
+    }
+}
+
+inline sampler*& current_sampler() {
+    thread_local sampler* current = nullptr;
+    return current;
+}
+
+class sampler_scope {
+    // Installs a sampler as the calling thread's current one for the scope's lifetime.
+public:
+    sampler_scope(sampler& s) : previous(current_sampler()) { current_sampler() = &s; }
+    ~sampler_scope() { current_sampler() = previous; }
+
+private:
+    sampler* previous;
+};
+
+inline double sample_1d() {
+    auto s = current_sampler();
+    return s ? s->get_1d() : random_double();
+}
+
+inline void sample_2d(double& u, double& v) {
+    if (auto s = current_sampler()) {
+        s->get_2d(u, v);
+    } else {
+        u = random_double();
+        v = random_double();
+    }
+}
+
+inline void sample_scatter_2d(double& u, double& v) {
+    // The pair the current bounce's scatter direction was drawn from (fresh numbers without a
+    // sampler), so a strategy used in its place keeps the sampler's stratification.
+    if (auto s = current_sampler()) {
+        s->scatter_2d(u, v);
+    } else {
+        u = random_double();
+        v = random_double();
+    }
+}
+
+inline vec3 sample_unit_vector() {
+    double u, v;
+    sample_2d(u, v);
+    return sphere_from_square(u, v);
+}
+
+inline vec3 sample_in_unit_disk() {
+    double u, v;
+    sample_2d(u, v);
+    return disk_from_square(u, v);
+}
+
+#endif
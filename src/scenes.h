@@ -0,0 +1,271 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "constUtilFuncs.h"
+
+#include "asset_loader.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "quad.h"
+#include "stress_scenes.h"
+#include "texture.h"
+
+#include <vector>
+
+inline hittable_list random_spheres(){
+    hittable_list world;
+  
+
+    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+
+    auto ground_material =  make_shared<lambertian>(checker);
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+
+                if (choose_mat < 0.05){
+                    auto eart_texture = make_shared<image_texture>("earthmap.jpg");
+                    sphere_material = make_shared<lambertian>(eart_texture);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_shared<lambertian>(albedo);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+
+                    // Add  Movement
+                    // auto center2 = center + vec3(0, random_double(0,.5), 0);
+                    // world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
+
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = make_shared<metal>(albedo, fuzz);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                } else {
+                    // glass
+                    sphere_material = make_shared<dielectric>(1.5);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto eart_texture = make_shared<image_texture>("earthmap.jpg");
+    auto material1 = make_shared<lambertian>(eart_texture);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_shared<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material2));
+    world.add(make_shared<sphere>(point3(4, 1, 0), -0.95, material2));
+
+    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material3));
+
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    return world;
+};
+
+inline hittable_list two_spheres() {
+    hittable_list world;
+
+    auto checker = make_shared<checker_texture>(0.3, color(.2, .3, .1), color(.9, .9, .9));
+
+    world.add(make_shared<sphere>(point3(0,-10, 0), 10, make_shared<lambertian>(checker)));
+    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
+    
+    return world;
+}
+
+inline hittable_list earth() {
+    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
+    auto earth_surface = make_shared<lambertian>(earth_texture);
+    auto globe = make_shared<sphere>(point3(0,0,0), 2, earth_surface);
+
+    return hittable_list(globe);
+}
+
+inline hittable_list two_perlin_spheres() {
+    hittable_list world;
+
+    auto pertext = make_shared<noise_texture>(1);
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
+    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
+
+    return world;
+};
+
+inline hittable_list quads(){
+    hittable_list world;
+
+    // Materials
+    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
+    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
+    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
+    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
+    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+
+    // Quads
+    world.add(make_shared<quad>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
+    world.add(make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world.add(make_shared<quad>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+    world.add(make_shared<quad>(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
+
+    return world;
+}
+
+inline hittable_list cube_big_ligth(){
+    hittable_list world;
+
+    // Materials
+    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
+    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
+    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
+    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
+    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+    
+    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
+    auto earth_surface = make_shared<lambertian>(earth_texture);
+
+    auto ligth_material = make_shared<diffuse_light>(color(1,1,1));
+
+    // Earth
+    world.add(make_shared<sphere>(point3(0, 0, 2), 1, earth_surface));
+
+
+    // Quads
+    world.add(make_shared<quad>(point3(-2,-2, 4), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
+    world.add(make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world.add(make_shared<quad>(point3( 2,-2, 0), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world.add(make_shared<quad>(point3(-2, 2, 0), vec3(4, 0, 0), vec3(0, 0, 4), ligth_material));
+    world.add(make_shared<quad>(point3(-2,-2, 4), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
+
+    return world;
+}
+
+
+inline hittable_list cube_small_ligth(){
+    hittable_list world;
+
+    // Materials
+    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
+    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
+    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
+    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
+    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+    
+    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
+    auto earth_surface = make_shared<lambertian>(earth_texture);
+
+    auto ligth_material = make_shared<diffuse_light>(color(15,15,15));
+
+    // Earth
+    world.add(make_shared<sphere>(point3(0, 0, 2), 1, earth_surface));
+    
+    // Ligth
+    world.add(make_shared<quad>(point3(-1.0, 1.9, 1.0), vec3(2, 0, 0), vec3(0, 0, 2), ligth_material));
+
+    // Quads
+    world.add(make_shared<quad>(point3(-2,-2, 4), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
+    world.add(make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world.add(make_shared<quad>(point3( 2,-2, 0), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world.add(make_shared<quad>(point3(-2, 2, 0), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+    world.add(make_shared<quad>(point3(-2,-2, 4), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
+
+    return world;
+}
+
+struct scene_entry {
+    const char* name;
+    hittable_list (*build)();
+};
+
+inline const std::vector<scene_entry>& builtin_scenes() {
+    // The built-in scenes, in the order used for `switch` scene selection in main.cpp.
+    static const std::vector<scene_entry> scenes = {
+        {"random_spheres",     random_spheres},
+        {"two_spheres",        two_spheres},
+        {"earth",              earth},
+        {"two_perlin_spheres", two_perlin_spheres},
+        {"quads",              quads},
+        {"cube_big_ligth",     cube_big_ligth},
+        {"cube_small_ligth",   cube_small_ligth},
+    };
+    return scenes;
+}
+
+struct stress_scene_entry {
+    const char* name;
+    size_t default_count;
+    hittable_list (*build)(size_t count, uint64_t seed);
+};
+
+inline const std::vector<stress_scene_entry>& stress_scenes() {
+    // Procedural scenes (see stress_scenes.h), numbered after the built-in ones. Not part of
+    // builtin_scenes(), so the regression harness does not render them.
+    static const std::vector<stress_scene_entry> scenes = {
+        {"stress_spheres",   1000000, [](size_t n, uint64_t seed) { return stress_spheres(n, seed, false); }},
+        {"stress_clusters",  1000000, [](size_t n, uint64_t seed) { return stress_spheres(n, seed, true); }},
+        {"stress_quad_grid", 1000000, stress_quad_grid},
+        {"stress_mixed",     250000,  stress_mixed},
+        {"stress_boxes",     1000000, stress_boxes},
+    };
+    return scenes;
+}
+
+inline int scene_count() {
+    return static_cast<int>(builtin_scenes().size() + stress_scenes().size());
+}
+
+inline hittable_list build_scene_objects(int scene, size_t size) {
+    switch (scene)  {
+        case 1: return random_spheres();
+        case 2: return two_spheres();
+        case 3: return earth();
+        case 4: return two_perlin_spheres();
+        case 5: return quads();
+        case 6: return cube_big_ligth();
+        case 7: return cube_small_ligth();
+    }
+    int stress = scene - 1 - static_cast<int>(builtin_scenes().size());
+    if (stress >= 0 && stress < static_cast<int>(stress_scenes().size())) {
+        const auto& entry = stress_scenes()[stress];
+        auto seed = static_cast<uint64_t>(random_double() * 0x1p53);
+        return entry.build(size ? size : entry.default_count, seed);
+    }
+    return hittable_list();
+}
+
+inline hittable_list build_scene(int scene, size_t size = 0) {
+    // Builds scene number `scene`: 1-based, the built-in scenes first and then the stress
+    // scenes. `size` overrides a stress scene's object count (0 keeps the default). Stress
+    // scenes take their seed from the current random stream, like the built-in ones.
+    //
+    // Textures decode on worker threads while the geometry and its BVH are built here; the
+    // scene is returned once both are done (see asset_loader.h).
+    asset_loader loader;
+    hittable_list world;
+    {
+        asset_loader_scope scope(loader);
+        world = build_scene_objects(scene, size);
+    }
+    loader.wait();
+    return world;
+}
+
+#endif
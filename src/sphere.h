@@ -1,8 +1,14 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 
+#include "fast_math.h"
 #include "vec3.h"
 #include "hittable.h"
+#include "material.h"
+#include "sampler.h"
+
+#include <stdexcept>
+#include <vector>
 
 class sphere : public hittable {
 public:
@@ -26,7 +32,24 @@ public:
         center_vec = _center2 - _center1;
     }
 
+	// Sphere moving through keyframe centers, evenly spaced over the shutter interval [0,1]. At
+	// least one center is required. As a light it is sampled at its first center whatever the
+	// shadow ray's time (pdf_value and random have no time to go by), so keep emissive spheres
+	// still or nearly so.
+	sphere(const std::vector<point3>& centers, double _radius, shared_ptr<material> _material)
+	  : center1(first_center(centers)), radius(_radius), mat(_material), is_moving(centers.size() > 1)
+	{
+		auto rvec = vec3(radius, radius, radius);
+		for (const auto& c : centers)
+			bbox = aabb(bbox, aabb(c - rvec, c + rvec));
+		if (centers.size() > 1)
+			center_vec = centers.back() - centers.front();
+		if (centers.size() > 2)
+			keyframes = centers;
+	}
+
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		RT_STAT(thread_stats().primitive_tests++);
 		point3 center = is_moving ? sphere_center(r.time()) : center1;
 		vec3 oc = r.origin() - center;
 		auto a = r.direction().length_squared();
@@ -51,24 +74,135 @@ public:
 		rec.set_face_normal(r, outward_normal);
 		get_sphere_uv(outward_normal, rec.u, rec.v);
 		rec.mat = mat;
+		rec.object = this;
 
 		return true;
 	}
 
+	bool occluded(const ray& r, interval ray_t) const override {
+		RT_STAT(thread_stats().primitive_tests++);
+		point3 center = is_moving ? sphere_center(r.time()) : center1;
+		vec3 oc = r.origin() - center;
+		auto a = r.direction().length_squared();
+		auto half_b = dot(oc, r.direction());
+		auto c = oc.length_squared() - radius*radius;
+
+		auto discriminant = half_b*half_b - a*c;
+		if (discriminant < 0) return false;
+		auto sqrtd = sqrt(discriminant);
+
+		return ray_t.surrounds((-half_b - sqrtd) / a) || ray_t.surrounds((-half_b + sqrtd) / a);
+	}
+
 	aabb bounding_box() const override { return bbox; }
 
+	bool has_motion() const override { return is_moving; }
+
+	void motion_bounds(aabb& start, aabb& end) const override {
+		// The boxes at the first and last center, widened on each side by the furthest any
+		// keyframe strays outside the straight line between them.
+		auto rvec = vec3(radius, radius, radius);
+		vec3 below(0,0,0), above(0,0,0);
+		for (size_t k = 1; k + 1 < keyframes.size(); k++) {
+			auto on_line = center1 + double(k) / (keyframes.size() - 1) * center_vec;
+			for (int a = 0; a < 3; a++) {
+				below[a] = fmax(below[a], on_line[a] - keyframes[k][a]);
+				above[a] = fmax(above[a], keyframes[k][a] - on_line[a]);
+			}
+		}
+		auto center2 = center1 + center_vec;
+		start = aabb(center1 - rvec - below, center1 + rvec + above);
+		end = aabb(center2 - rvec - below, center2 + rvec + above);
+	}
+
+	// Emissive spheres are sampled by the cone they subtend, at their start position.
+	double pdf_value(const point3& origin, const vec3& direction) const override {
+		hit_record rec;
+		if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+			return 0;
+
+		auto distance_squared = (center1 - origin).length_squared();
+		if (distance_squared <= radius*radius)
+			return 0;  // Not sampled from inside
+		auto cos_theta_max = sqrt(1 - radius*radius/distance_squared);
+		auto solid_angle = 2*pi*(1 - cos_theta_max);
+		return 1 / solid_angle;
+	}
+
+	vec3 random(const point3& origin) const override {
+		vec3 direction = center1 - origin;
+		auto distance_squared = direction.length_squared();
+		if (distance_squared <= radius*radius)
+			return sample_unit_vector();
+
+		double r1, r2;
+		sample_2d(r1, r2);
+		auto z = 1 + r2*(sqrt(1 - radius*radius/distance_squared) - 1);
+		auto phi = 2*pi*r1;
+		auto x = cos(phi)*sqrt(1 - z*z);
+		auto y = sin(phi)*sqrt(1 - z*z);
+
+		// Orthonormal basis around the direction to the center.
+		vec3 w = unit_vector(direction);
+		vec3 a = (fabs(w.x()) > 0.9) ? vec3(0,1,0) : vec3(1,0,0);
+		vec3 v = unit_vector(cross(w, a));
+		vec3 u = cross(w, v);
+		return x*u + y*v + z*w;
+	}
+
+	double surface_area() const override { return 4*pi*radius*radius; }
+
+	// Photons leave a moving sphere from its start position, like light samples.
+	void sample_surface(double s, double t, hit_record& rec) const override {
+		auto outward_normal = sphere_from_square(s, t);
+		rec.p = center1 + radius * outward_normal;
+		rec.normal = outward_normal;
+		rec.front_face = true;
+		get_sphere_uv(outward_normal, rec.u, rec.v);
+		rec.mat = mat;
+		rec.object = this;
+	}
+
+	void collect_emitters(std::vector<const hittable*>& emitters) const override {
+		if (mat && mat->is_emissive())
+			emitters.push_back(this);
+	}
+
+	emitter_bounds emission_bounds() const override {
+		emitter_bounds e;
+		auto radiance = mat->emitted(0.5, 0.5, center1);
+		e.bounds = bbox;
+		e.cos_theta_o = -1;  // Faces every direction
+		e.power = (radiance.x() + radiance.y() + radiance.z()) / 3 * 4*pi*radius*radius * pi;
+		return e;
+	}
+
 private:
 	point3 center1;
 	double radius;
 	shared_ptr<material> mat;
 	bool is_moving;
 	vec3 center_vec;
+	std::vector<point3> keyframes;  // More than two centers; empty for linear motion
 	aabb bbox;
 
+	static const point3& first_center(const std::vector<point3>& centers) {
+		if (centers.empty())
+			throw std::invalid_argument("sphere: keyframe motion needs at least one center");
+		return centers.front();
+	}
+
 	point3 sphere_center(double time) const {
         // Linearly interpolate from center1 to center2 according to time, where t=0 yields
         // center1, and t=1 yields center2.
-        return center1 + time*center_vec;
+        if (keyframes.empty())
+            return center1 + time*center_vec;
+
+        // Between keyframes, the center moves linearly from one to the next.
+        auto segments = keyframes.size() - 1;
+        auto s = fmin(fmax(time, 0.0), 1.0) * segments;
+        auto k = std::min(size_t(s), segments - 1);
+        return keyframes[k] + (s - k) * (keyframes[k + 1] - keyframes[k]);
     }
 
 	static void get_sphere_uv(const point3& p, double& u, double& v) {
@@ -79,8 +213,8 @@ private:
         //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
         //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
 
-        auto theta = acos(-p.y());
-        auto phi = atan2(-p.z(), p.x()) + pi;
+        auto theta = fast_acos(-p.y());
+        auto phi = fast_atan2(-p.z(), p.x()) + pi;
 
         u = phi / (2*pi);
         v = theta / pi;
@@ -11,7 +11,12 @@
 #include "external/stb_image.h"
 
 #include <cstdlib>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 
 class rt_image {
   public:
@@ -42,12 +47,14 @@ class rt_image {
         std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
     }
 
-    ~rt_image() { STBI_FREE(data); }
-
     bool load(const std::string filename) {
-        // Loads image data from the given file name. Returns true if the load succeeded.
-        auto n = bytes_per_pixel; // Dummy out parameter: original components per pixel
-        data = stbi_load(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
+        // Loads image data from the given file name. Returns true if the load succeeded. Images
+        // that are already loaded (by any rt_image still alive) or being decoded are shared
+        // instead of decoded again.
+        pixels = cached_load(filename);
+        data = pixels ? pixels->data : nullptr;
+        image_width = pixels ? pixels->width : 0;
+        image_height = pixels ? pixels->height : 0;
         bytes_per_scanline = image_width * bytes_per_pixel;
         return data != nullptr;
     }
@@ -67,11 +74,57 @@ class rt_image {
     }
 
   private:
-    const int bytes_per_pixel = 3;
+    struct decoded_image {
+        unsigned char *data = nullptr;
+        int width = 0, height = 0;
+        ~decoded_image() { STBI_FREE(data); }
+    };
+
+    static const int bytes_per_pixel = 3;
+    std::shared_ptr<const decoded_image> pixels;
     unsigned char *data;
     int image_width, image_height;
     int bytes_per_scanline;
 
+    static std::shared_ptr<const decoded_image> cached_load(const std::string& filename) {
+        // The lock only covers the lookups: different files decode in parallel, and a load of a
+        // file that is already being decoded waits for that decode instead of starting another.
+        using shared_image = std::shared_ptr<const decoded_image>;
+        static std::mutex mtx;
+        static std::map<std::string, std::weak_ptr<const decoded_image>> cache;
+        static std::map<std::string, std::shared_future<shared_image>> decoding;
+
+        std::promise<shared_image> decoded;
+        std::shared_future<shared_image> in_progress;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto cached = cache.find(filename);
+            if (cached != cache.end())
+                if (auto image = cached->second.lock())
+                    return image;
+            auto pending = decoding.find(filename);
+            if (pending != decoding.end())
+                in_progress = pending->second;
+            else
+                decoding[filename] = decoded.get_future().share();
+        }
+        if (in_progress.valid())
+            return in_progress.get();
+
+        auto image = std::make_shared<decoded_image>();
+        auto n = bytes_per_pixel; // Dummy out parameter: original components per pixel
+        image->data = stbi_load(filename.c_str(), &image->width, &image->height, &n, bytes_per_pixel);
+        shared_image result = image->data ? image : nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (result)
+                cache[filename] = result;
+            decoding.erase(filename);
+        }
+        decoded.set_value(result);
+        return result;
+    }
+
     static int clamp(int x, int low, int high) {
         // Return the value clamped to the range [low, high).
         if (x < low) return low;
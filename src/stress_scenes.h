@@ -0,0 +1,203 @@
+#ifndef STRESS_SCENES_H
+#define STRESS_SCENES_H
+
+#include "constUtilFuncs.h"
+
+#include "box.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "quad.h"
+#include "texture.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <tbb/parallel_for.h>
+
+// Procedural scenes for measuring BVH build, memory and traversal at sizes far beyond the
+// hand-made scenes. Every generator takes an object count and a seed. Object i is generated from
+// its own random stream derived from (seed, i), so objects are created in parallel and the scene
+// is the same for a given count and seed whatever the thread count. Materials come from a small
+// shared palette, so memory grows with the geometry only.
+//
+// All scenes fill roughly the same [-4,4]^3 volume in front of the default camera at any count;
+// objects shrink as the count grows.
+
+namespace stress_detail {
+
+struct object_rng {
+    // splitmix64: a tiny, well-mixed generator that is cheap to seed per object.
+    uint64_t state;
+
+    object_rng(uint64_t seed, uint64_t index) : state(seed * 0x9e3779b97f4a7c15ull ^ (index + 0x632be59bd9b4e019ull)) {
+        next();
+    }
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    double uniform() { return (next() >> 11) * 0x1.0p-53; }
+    double uniform(double min, double max) { return min + (max - min) * uniform(); }
+    size_t below(size_t n) { return size_t(uniform() * n); }
+    color albedo() { return color(uniform(), uniform(), uniform()) * color(uniform(), uniform(), uniform()); }
+};
+
+const double half_extent = 4.0;
+
+inline std::vector<point3> cluster_centers(uint64_t seed, size_t count) {
+    std::vector<point3> centers;
+    object_rng rng(seed, ~uint64_t(0));
+    auto reach = half_extent * 0.8;
+    for (size_t c = 0; c < count; c++)
+        centers.push_back(point3(rng.uniform(-reach, reach), rng.uniform(-reach, reach), rng.uniform(-reach, reach)));
+    return centers;
+}
+
+inline point3 place(object_rng& rng, const std::vector<point3>& clusters) {
+    // Uniform in the volume, or around a random cluster center (roughly Gaussian, sigma 0.3).
+    if (clusters.empty())
+        return point3(rng.uniform(-half_extent, half_extent), rng.uniform(-half_extent, half_extent),
+                      rng.uniform(-half_extent, half_extent));
+    auto offset = [&] { return (rng.uniform() + rng.uniform() + rng.uniform() - 1.5) * 0.6; };
+    return clusters[rng.below(clusters.size())] + vec3(offset(), offset(), offset());
+}
+
+inline std::vector<shared_ptr<material>> plain_palette(uint64_t seed) {
+    // Mostly diffuse, some metal, a little glass, like random_spheres.
+    std::vector<shared_ptr<material>> palette;
+    object_rng rng(seed, ~uint64_t(1));
+    for (int i = 0; i < 24; i++) palette.push_back(make_shared<lambertian>(rng.albedo()));
+    for (int i = 0; i < 6; i++)  palette.push_back(make_shared<metal>(color(rng.uniform(0.5, 1), rng.uniform(0.5, 1), rng.uniform(0.5, 1)), rng.uniform(0, 0.5)));
+    for (int i = 0; i < 2; i++)  palette.push_back(make_shared<dielectric>(1.5));
+    return palette;
+}
+
+inline shared_ptr<hittable> finish(std::vector<shared_ptr<hittable>>&& objects) {
+    return make_shared<bvh_node>(std::move(objects));
+}
+
+} // namespace stress_detail
+
+inline hittable_list stress_spheres(size_t count, uint64_t seed, bool clustered) {
+    // `count` spheres, uniform in the volume or gathered in cbrt(count) clusters.
+    using namespace stress_detail;
+    auto palette = plain_palette(seed);
+    auto clusters = clustered ? cluster_centers(seed, std::max<size_t>(8, size_t(std::cbrt(double(count)))))
+                              : std::vector<point3>();
+    // Radii keep the total sphere volume at a few percent of the scene volume.
+    auto radius = 2 * half_extent / std::cbrt(double(std::max<size_t>(count, 1))) * (clustered ? 0.15 : 0.25);
+
+    std::vector<shared_ptr<hittable>> objects(count);
+    tbb::parallel_for(size_t(0), count, [&](size_t i) {
+        object_rng rng(seed, i);
+        auto center = place(rng, clusters);
+        auto r = radius * rng.uniform(0.4, 1.0);
+        objects[i] = make_shared<sphere>(center, r, palette[rng.below(palette.size())]);
+    });
+    return hittable_list(finish(std::move(objects)));
+}
+
+inline hittable_list stress_quad_grid(size_t count, uint64_t seed) {
+    // A square grid of about `count` quads forming a rippled wall facing the camera. Each tile
+    // follows the ripple's slope, so the grid is nearly closed but no two tiles are coplanar.
+    using namespace stress_detail;
+    auto palette = plain_palette(seed);
+    size_t side = std::max<size_t>(1, size_t(std::sqrt(double(count))));
+    auto cell = 4 * half_extent / side;
+    auto phase = object_rng(seed, ~uint64_t(2)).uniform(0, 2 * pi);
+    auto height = [&](double x, double y) {
+        return -half_extent + 0.6 * std::sin(0.9 * x + phase) * std::cos(0.7 * y - phase);
+    };
+
+    std::vector<shared_ptr<hittable>> objects(side * side);
+    tbb::parallel_for(size_t(0), side, [&](size_t row) {
+        for (size_t col = 0; col < side; col++) {
+            auto i = row * side + col;
+            object_rng rng(seed, i);
+            auto x = -2 * half_extent + col * cell, y = -2 * half_extent + row * cell;
+            auto z = height(x, y);
+            point3 corner(x, y, z);
+            vec3 u(cell, 0, height(x + cell, y) - z);
+            vec3 v(0, cell, height(x, y + cell) - z);
+            objects[i] = make_shared<quad>(corner, u, v, palette[rng.below(palette.size())]);
+        }
+    });
+    return hittable_list(finish(std::move(objects)));
+}
+
+inline hittable_list stress_boxes(size_t count, uint64_t seed) {
+    // A city-like grid of about `count` boxes standing on the floor, of random heights, each with
+    // its own wall and roof materials. One in four is turned about the vertical.
+    using namespace stress_detail;
+    auto palette = plain_palette(seed);
+    size_t side = std::max<size_t>(1, size_t(std::sqrt(double(count))));
+    auto cell = 2 * half_extent / side;
+
+    std::vector<shared_ptr<hittable>> objects(side * side);
+    tbb::parallel_for(size_t(0), side, [&](size_t row) {
+        for (size_t col = 0; col < side; col++) {
+            auto i = row * side + col;
+            object_rng rng(seed, i);
+            auto width = cell * rng.uniform(0.3, 0.45), depth = cell * rng.uniform(0.3, 0.45);
+            auto height = half_extent * (0.05 + rng.uniform() * rng.uniform());
+            point3 center(-half_extent + (col + 0.5) * cell, -half_extent + height, -half_extent + (row + 0.5) * cell);
+            auto wall = palette[rng.below(palette.size())], roof = palette[rng.below(palette.size())];
+            std::array<shared_ptr<material>, 6> faces = { wall, wall, wall, roof, wall, wall };
+            if (rng.uniform() < 0.25) {
+                auto angle = rng.uniform(0, pi / 2);
+                objects[i] = make_shared<box>(center, vec3(width, height, depth), vec3(cos(angle), 0, sin(angle)),
+                                              vec3(0, 1, 0), faces);
+            } else {
+                objects[i] = make_shared<box>(center - vec3(width, height, depth), center + vec3(width, height, depth),
+                                              faces);
+            }
+        }
+    });
+    return hittable_list(finish(std::move(objects)));
+}
+
+inline hittable_list stress_mixed(size_t count, uint64_t seed) {
+    // Clustered spheres and free-floating quads with plain, textured and emissive materials.
+    // About one object in a thousand (at least 4, at most 256) is a light.
+    using namespace stress_detail;
+    auto palette = plain_palette(seed);
+    palette.push_back(make_shared<lambertian>(make_shared<checker_texture>(0.1, color(.2, .3, .1), color(.9, .9, .9))));
+    palette.push_back(make_shared<lambertian>(make_shared<noise_texture>(8)));
+    palette.push_back(make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg")));
+    std::vector<shared_ptr<material>> lights;
+    for (int i = 0; i < 4; i++) {
+        object_rng rng(seed, ~uint64_t(3 + i));
+        lights.push_back(make_shared<diffuse_light>(color(rng.uniform(2, 8), rng.uniform(2, 8), rng.uniform(2, 8))));
+    }
+    size_t light_count = std::min<size_t>(256, std::max<size_t>(4, count / 1000));
+    auto clusters = cluster_centers(seed, std::max<size_t>(8, size_t(std::cbrt(double(count)))));
+    auto size = 2 * half_extent / std::cbrt(double(std::max<size_t>(count, 1))) * 0.2;
+
+    const std::vector<point3> uniform_layout;
+
+    std::vector<shared_ptr<hittable>> objects(count);
+    tbb::parallel_for(size_t(0), count, [&](size_t i) {
+        object_rng rng(seed, i);
+        bool light = i < light_count;
+        auto mat = light ? lights[i % lights.size()] : palette[rng.below(palette.size())];
+        auto center = place(rng, light ? uniform_layout : clusters);
+        auto s = size * rng.uniform(0.4, 1.0);
+        if (rng.uniform() < 0.7) {
+            objects[i] = make_shared<sphere>(center, s, mat);
+        } else {
+            auto u = 2 * s * unit_vector(vec3(rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1)) + vec3(1e-3, 0, 0));
+            auto v = 2 * s * unit_vector(cross(u, vec3(rng.uniform(-1, 1), rng.uniform(-1, 1), 1)));
+            objects[i] = make_shared<quad>(center - 0.5 * (u + v), u, v, mat);
+        }
+    });
+    return hittable_list(finish(std::move(objects)));
+}
+
+#endif
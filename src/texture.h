@@ -3,6 +3,8 @@
 
 #include "constUtilFuncs.h"
 
+#include "asset_loader.h"
+#include "fast_math.h"
 #include "stb_image_rt.h"
 #include "color.h"
 #include "perlin.h"
@@ -58,7 +60,17 @@ private:
 
 class image_texture : public texture {
 public:
-	image_texture(const char* filename) : image(filename) {}
+	image_texture(const char* filename) {
+		// Decoded on the current asset_loader if there is one (this texture must stay put until
+		// the loader is waited for, hence no copies).
+		load_asset([this, name = std::string(filename)] { image = rt_image(name.c_str()); });
+	}
+
+	image_texture(const image_texture&) = delete;
+	image_texture& operator=(const image_texture&) = delete;
+
+	// False if the image file could not be found or decoded (value() is then solid cyan).
+	bool loaded() const { return image.height() > 0; }
 
 	color value(double u, double v, const point3& p) const override {
 		// If we have no texture data, then return solid cyan as a debugging aid.
@@ -89,7 +101,7 @@ public:
 
 	color value(double u, double v, const point3& p) const override {
 		auto s = scale * p;
-		return color(1,1,1) * 0.5 * (1 + sin(s.z() + 10*noise.turb(s)));
+		return color(1,1,1) * 0.5 * (1 + fast_sin(s.z() + 10*noise.turb(s)));
 	}
 
 private:
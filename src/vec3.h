@@ -113,24 +113,41 @@ inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
 
-inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() < 1)
-            return p;
+inline vec3 disk_from_square(double u, double v) {
+    // Maps [0,1)^2 onto the unit disk (Shirley-Chiu concentric mapping). Area-preserving and
+    // low-distortion, so stratification of (u,v) carries over to the disk.
+    double a = 2*u - 1, b = 2*v - 1;
+    if (a == 0 && b == 0)
+        return vec3(0,0,0);
+    double r, phi;
+    if (a*a > b*b) {
+        r = a;
+        phi = (pi/4) * (b/a);
+    } else {
+        r = b;
+        phi = (pi/2) - (pi/4) * (a/b);
     }
+    return vec3(r*cos(phi), r*sin(phi), 0);
 }
 
-inline vec3 random_in_unit_sphere() {
-    while (true) {
-        auto p = vec3::random(-1,1);
-        if (p.length_squared() < 1)
-            return p;
-    }
+inline vec3 sphere_from_square(double u, double v) {
+    // Maps [0,1)^2 onto the unit sphere with uniform area density.
+    double z = 1 - 2*u;
+    double r = sqrt(fmax(0.0, 1 - z*z));
+    double phi = 2*pi*v;
+    return vec3(r*cos(phi), r*sin(phi), z);
+}
+
+inline vec3 random_in_unit_disk() {
+    return disk_from_square(random_double(), random_double());
 }
 
 inline vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+    return sphere_from_square(random_double(), random_double());
+}
+
+inline vec3 random_in_unit_sphere() {
+    return std::cbrt(random_double()) * random_unit_vector();
 }
 
 inline vec3 random_on_hemisphere(const vec3& normal) {